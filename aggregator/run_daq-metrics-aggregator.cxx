@@ -0,0 +1,252 @@
+// Per-host aggregator of metrics.
+// Reads the shared memory tables of the metrics plugins on this host (metrics-exporter=shm)
+// and writes the new samples of all devices to RedisTimeSeries with one pipeline per interval.
+// Only the time series go through the tables. The registry hashes (state, last-update, ...)
+// are still written by the metrics plugin of each device.
+
+#include <dirent.h>
+#include <signal.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/program_options.hpp>
+
+#include <fairmq/FairMQLogger.h>
+
+#include <sw/redis++/redis++.h>
+
+#include "plugins/MetricsShmTable.h"
+#include "plugins/tools.h"
+
+namespace bpo = boost::program_options;
+
+using daq::service::MetricsShmTable;
+
+namespace {
+std::atomic<bool> gStopRequested{false};
+
+struct EntryState {
+    bool known{false};
+    uint32_t generation{0};
+    std::string key; // empty if the entry is free
+    std::vector<std::string> labels; // <name> <value> ...
+    // timestamp of the last sample sent (0 = series not yet created or labels not yet written)
+    int64_t lastTimestamp{0};
+};
+
+struct TableState {
+    std::unique_ptr<MetricsShmTable> table;
+    std::vector<EntryState> entries;
+};
+}
+
+//_____________________________________________________________________________
+bpo::options_description MakeOption()
+{
+    bpo::options_description options("options");
+    bpo::options_description redisOptions("redis options");
+    bpo::options_description logOptions("log options");
+
+    redisOptions.add_options()
+    //
+    ("redis-uri", bpo::value<std::string>()->default_value("tcp://127.0.0.1:6379"), "URI of redis-server")
+    //
+    ("retention", bpo::value<std::string>()->default_value("0"), "Retention time in msec for time series data created by the aggregator. (0 = not trimmed)")
+    //
+    ("interval", bpo::value<long long>()->default_value(1000), "interval in milliseconds to read the tables and write to redis");
+
+    logOptions.add_options()
+    //
+    ("severity", bpo::value<std::string>()->default_value("info"), "FairLogger Log severity level (console): trace, debug, info, state, warn, error, fatal, nolog")
+    //
+    ("verbosity", bpo::value<std::string>()->default_value("medium"), "FairLogger Log verbosity level: veryhigh, high, medium, low")
+    //
+    ("color", bpo::value<bool>()->default_value(true), "FairLogger Log color (true/false)");
+
+    options.add_options()
+    //
+    ("help,h", "print this help");
+
+    options.add(redisOptions)
+    .add(logOptions);
+    return options;
+}
+
+//_____________________________________________________________________________
+// open new tables in /dev/shm and close the tables of exited processes
+void ScanTables(std::map<std::string, TableState> &tables)
+{
+    for (auto itr = tables.begin(); itr != tables.end();) {
+        const auto pid = itr->second.table->Pid();
+        if ((kill(pid, 0) != 0) && (errno == ESRCH)) {
+            // a device restarted with the same id has already replaced the table under the same name.
+            // only the table of the exited process (same inode as the mapping) is unlinked.
+            const auto linked = itr->second.table->IsLinked();
+            LOG(info) << "remove table " << itr->first << " (pid = " << pid << " exited" << (linked ? ")" : ", replaced by a new table)");
+            if (linked) {
+                shm_unlink(itr->first.data());
+            }
+            itr = tables.erase(itr);
+        } else {
+            ++itr;
+        }
+    }
+
+    auto dir = opendir("/dev/shm");
+    if (dir == nullptr) {
+        return;
+    }
+    while (auto e = readdir(dir)) {
+        if (std::strncmp(e->d_name, MetricsShmTable::NamePrefix.data(), MetricsShmTable::NamePrefix.size()) != 0) {
+            continue;
+        }
+        const auto name = "/" + std::string(e->d_name);
+        if (tables.count(name) > 0) {
+            continue;
+        }
+        auto t = MetricsShmTable::Open(name);
+        if (!t) {
+            continue;
+        }
+        LOG(info) << "add table " << name << " (id = " << t->Id() << ", pid = " << t->Pid() << ")";
+        tables[name].table = std::move(t);
+    }
+    closedir(dir);
+}
+
+//_____________________________________________________________________________
+// returns the number of samples written
+std::size_t Publish(sw::redis::Redis &client, std::map<std::string, TableState> &tables, const std::string &retention)
+{
+    auto pipe = client.pipeline();
+    std::vector<std::string> madd{"ts.madd"};
+    std::size_t n{0};
+    for (auto &[name, s] : tables) {
+        const auto &t = *s.table;
+        const auto size = t.Size();
+        s.entries.resize(size);
+        for (auto i = 0u; i < size; ++i) {
+            auto &e = s.entries[i];
+            double value{0};
+            int64_t timestamp{0};
+            uint32_t generation{0};
+            bool ok{false};
+            for (auto retry = 0; retry < 4 && !ok; ++retry) {
+                ok = t.Read(i, value, timestamp, generation);
+            }
+            if (!ok) {
+                continue;
+            }
+            if (!e.known || (generation != e.generation)) {
+                // new entry, entry reused by another series or labels rewritten (e.g. run number)
+                std::string key;
+                std::string labels;
+                uint32_t g{0};
+                if (!t.ReadKey(i, key, labels, g) || (g != generation)) {
+                    continue;
+                }
+                e.known         = true;
+                e.generation    = generation;
+                e.key           = std::move(key);
+                e.lastTimestamp = 0;
+                e.labels.clear();
+                std::vector<std::string> fields;
+                boost::split(fields, labels, boost::is_any_of("\n"), boost::token_compress_on);
+                for (const auto &l : fields) {
+                    const auto p = l.find('=');
+                    if (p != std::string::npos) {
+                        e.labels.push_back(l.substr(0, p));
+                        e.labels.push_back(l.substr(p + 1));
+                    }
+                }
+            }
+            if (e.key.empty() || (timestamp <= e.lastTimestamp)) {
+                continue;
+            }
+            if (e.lastTimestamp == 0) {
+                // the first sample creates the series with labels (ignored if the series exists),
+                // ts.alter replaces the labels of an existing series
+                std::vector<std::string> cmd{"ts.add", e.key, std::to_string(timestamp), std::to_string(value),
+                                             "retention", retention, "on_duplicate", "last", "labels"};
+                cmd.insert(cmd.end(), e.labels.cbegin(), e.labels.cend());
+                pipe.command(cmd.cbegin(), cmd.cend());
+                if (!e.labels.empty()) {
+                    cmd.assign({"ts.alter", e.key, "labels"});
+                    cmd.insert(cmd.end(), e.labels.cbegin(), e.labels.cend());
+                    pipe.command(cmd.cbegin(), cmd.cend());
+                }
+            } else {
+                madd.push_back(e.key);
+                madd.push_back(std::to_string(timestamp));
+                madd.push_back(std::to_string(value));
+            }
+            e.lastTimestamp = timestamp;
+            ++n;
+        }
+    }
+    if (madd.size() > 1) {
+        pipe.command(madd.cbegin(), madd.cend());
+    }
+    if (n > 0) {
+        pipe.exec();
+    }
+    return n;
+}
+
+//_____________________________________________________________________________
+int main(int argc, char* argv[])
+{
+    bpo::variables_map vm;
+    auto ret = ParseCommandLine(argc, argv, MakeOption(), vm);
+    if (ret!=EXIT_SUCCESS) {
+        return ret;
+    }
+
+    fair::Logger::SetVerbosity(vm["verbosity"].as<std::string>());
+    fair::Logger::SetConsoleColor(vm["color"].as<bool>());
+    fair::Logger::SetConsoleSeverity(vm["severity"].as<std::string>());
+
+    std::signal(SIGINT,  [](int) { gStopRequested = true; });
+    std::signal(SIGTERM, [](int) { gStopRequested = true; });
+
+    const auto redisUri  = vm["redis-uri"].as<std::string>();
+    const auto retention = vm["retention"].as<std::string>();
+    const auto interval  = std::chrono::milliseconds(vm["interval"].as<long long>());
+    LOG(info) << "redis-server URI = " << redisUri;
+    LOG(info) << "interval         = " << interval.count() << " ms";
+
+    std::map<std::string, TableState> tables;
+    auto next = std::chrono::steady_clock::now();
+    std::unique_ptr<sw::redis::Redis> client;
+    while (!gStopRequested) {
+        next += interval;
+        try {
+            if (!client) {
+                client = std::make_unique<sw::redis::Redis>(redisUri);
+            }
+            ScanTables(tables);
+            const auto n = Publish(*client, tables, retention);
+            LOG(debug) << "n tables = " << tables.size() << ", n samples = " << n;
+        } catch (const sw::redis::Error &e) {
+            LOG(error) << "redis++ exception: " << e.what();
+            client.reset();
+        } catch (const std::exception &e) {
+            LOG(error) << "exception: " << e.what();
+        }
+        std::this_thread::sleep_until(next);
+    }
+    LOG(info) << "bye";
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,211 @@
+// Benchmark of the /proc readers of the metrics plugin.
+// Compares the std::ifstream + std::getline + boost::split parsing (used before ProcFile)
+// with ProcFile (pread into a stack buffer and in-place parsing) for /proc/self/stat and /proc/stat.
+//
+//   daq-bench-procfile --n-reads 100000
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/program_options.hpp>
+
+#include "plugins/ProcFile.h"
+#include "plugins/tools.h"
+
+namespace bpo = boost::program_options;
+
+using daq::service::ProcFile;
+
+namespace {
+// same indices as in plugins/MetricsPlugin.cxx
+enum ProcStat {
+    User = 1,
+    Nice,
+    System,
+    Idle
+};
+
+enum ProcSelfStat {
+    State = 2,
+    Utime = 13,
+    Stime = 14,
+    Vsize = 22,
+    Rss   = 23,
+};
+
+struct Stat {
+    uint64_t a{0};
+    uint64_t b{0};
+    uint64_t c{0};
+    uint64_t d{0};
+    uint64_t sum() const {
+        return a + b + c + d;
+    }
+};
+
+//_____________________________________________________________________________
+Stat ReadSelfStatStream(std::ifstream &f)
+{
+    std::string s;
+    std::vector<std::string> v;
+    std::getline(f, s);
+    f.clear();
+    f.seekg(0);
+    boost::split(v, s, boost::is_space());
+    return {std::stoull(v[Utime]), std::stoull(v[Stime]), std::stoull(v[Vsize]), std::stoull(v[Rss])};
+}
+
+//_____________________________________________________________________________
+Stat ReadStatStream(std::ifstream &f)
+{
+    std::string s;
+    while (std::getline(f, s)) {
+        if (s.find("cpu ")==0) {
+            break;
+        }
+    }
+    f.clear();
+    f.seekg(0);
+    std::vector<std::string> v;
+    boost::trim_if(s, boost::is_space());
+    boost::split(v, s, boost::is_space(), boost::token_compress_on);
+    return {std::stoull(v[User]), std::stoull(v[Nice]), std::stoull(v[System]), std::stoull(v[Idle])};
+}
+
+//_____________________________________________________________________________
+Stat ReadSelfStatProcFile(const ProcFile &f)
+{
+    char buf[ProcFile::BufferSize];
+    auto s = f.Read(buf, sizeof(buf));
+    Stat ret;
+    const auto p = s.rfind(')');
+    if (p == std::string_view::npos) {
+        return ret;
+    }
+    s.remove_prefix(p+1);
+    for (int i=State; i<=Rss; ++i) {
+        const auto v = daq::service::NextField(s);
+        switch (i) {
+        case Utime:
+            ret.a = daq::service::ToUInt64(v);
+            break;
+        case Stime:
+            ret.b = daq::service::ToUInt64(v);
+            break;
+        case Vsize:
+            ret.c = daq::service::ToUInt64(v);
+            break;
+        case Rss:
+            ret.d = daq::service::ToUInt64(v);
+            break;
+        default:
+            break;
+        }
+    }
+    return ret;
+}
+
+//_____________________________________________________________________________
+Stat ReadStatProcFile(const ProcFile &f)
+{
+    char buf[ProcFile::BufferSize];
+    auto s = f.Read(buf, sizeof(buf));
+    Stat ret;
+    if (s.compare(0, 4, "cpu ") != 0) {
+        return ret;
+    }
+    s = s.substr(0, s.find('\n'));
+    for (int i=0; i<=Idle; ++i) {
+        const auto v = daq::service::NextField(s);
+        switch (i) {
+        case User:
+            ret.a = daq::service::ToUInt64(v);
+            break;
+        case Nice:
+            ret.b = daq::service::ToUInt64(v);
+            break;
+        case System:
+            ret.c = daq::service::ToUInt64(v);
+            break;
+        case Idle:
+            ret.d = daq::service::ToUInt64(v);
+            break;
+        default:
+            break;
+        }
+    }
+    return ret;
+}
+
+//_____________________________________________________________________________
+template <typename F>
+void Run(std::string_view name, std::size_t n, F read)
+{
+    uint64_t check{0};
+    const auto t0 = std::chrono::steady_clock::now();
+    for (auto i = 0u; i < n; ++i) {
+        check += read().sum();
+    }
+    const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+    std::cout << std::left << std::setw(28) << name << std::right << std::fixed << std::setprecision(0)
+              << std::setw(8) << (ns / n) << " ns/read"
+              << "  (check = " << (check / n) << ")" << std::endl;
+}
+}
+
+//_____________________________________________________________________________
+bpo::options_description MakeOption()
+{
+    bpo::options_description options("options");
+    options.add_options()
+    //
+    ("help,h", "print this help")
+    //
+    ("n-reads", bpo::value<std::size_t>()->default_value(100000), "number of reads per file and reader");
+    return options;
+}
+
+//_____________________________________________________________________________
+int main(int argc, char* argv[])
+{
+    bpo::variables_map vm;
+    auto ret = ParseCommandLine(argc, argv, MakeOption(), vm);
+    if (ret!=EXIT_SUCCESS) {
+        return ret;
+    }
+    const auto n = vm["n-reads"].as<std::size_t>();
+
+    {
+        std::ifstream f("/proc/self/stat");
+        Run("/proc/self/stat ifstream", n, [&f]() {
+            return ReadSelfStatStream(f);
+        });
+    }
+    {
+        ProcFile f("/proc/self/stat");
+        Run("/proc/self/stat ProcFile", n, [&f]() {
+            return ReadSelfStatProcFile(f);
+        });
+    }
+    {
+        std::ifstream f("/proc/stat");
+        Run("/proc/stat ifstream", n, [&f]() {
+            return ReadStatStream(f);
+        });
+    }
+    {
+        ProcFile f("/proc/stat");
+        Run("/proc/stat ProcFile", n, [&f]() {
+            return ReadStatProcFile(f);
+        });
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,143 @@
+// Benchmark of the state write of the daq_service plugin per device state transition.
+// Compares the latency seen by the state-change callback when the registry is written in the
+// callback thread (sync, before) and when the write is posted to the io_context thread (posted, after).
+// For the posted writes, the time until the write is done in the io_context thread is also shown.
+//
+//   daq-bench-state-write --redis-uri tcp://127.0.0.1:6379 --n-transitions 1000
+//
+// The keys are created under bench:state-write:* and deleted at the end.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/program_options.hpp>
+
+#include <sw/redis++/redis++.h>
+
+#include "plugins/tools.h"
+
+namespace bpo = boost::program_options;
+namespace net = boost::asio;
+
+namespace {
+const std::string StateKey{"bench:state-write:fair-mq-state"};
+const std::string HealthKey{"bench:state-write:health"};
+const std::vector<std::string> States{"INITIALIZING DEVICE", "INITIALIZED", "BINDING", "BOUND", "CONNECTING",
+                                      "DEVICE READY", "INITIALIZING TASK", "READY", "RUNNING", "READY",
+                                      "RESETTING TASK", "DEVICE READY", "RESETTING DEVICE", "IDLE"};
+constexpr int Ttl{60}; // sec
+
+struct Result {
+    std::string name;
+    std::vector<double> latency; // microseconds per transition
+};
+
+//_____________________________________________________________________________
+void Print(Result &r)
+{
+    std::sort(r.latency.begin(), r.latency.end());
+    double sum{0};
+    for (auto v : r.latency) {
+        sum += v;
+    }
+    const auto n    = r.latency.size();
+    const auto mean = sum / n;
+    std::cout << std::left << std::setw(14) << r.name << std::right << std::fixed << std::setprecision(1)
+              << " mean = " << std::setw(9) << mean << " us"
+              << ", p50 = " << std::setw(9) << r.latency[n / 2] << " us"
+              << ", p99 = " << std::setw(9) << r.latency[std::min(n - 1, n * 99 / 100)] << " us" << std::endl;
+}
+
+//_____________________________________________________________________________
+// same commands as the state-change callback of plugins/DaqServicePlugin.cxx
+void WriteState(sw::redis::Redis &client, const std::string &stateName)
+{
+    auto pipe = client.pipeline(false);
+    pipe.setex(StateKey, Ttl, stateName)
+    .hset(HealthKey, "fair:mq:state", stateName)
+    .expire(HealthKey, Ttl);
+    pipe.exec();
+}
+}
+
+//_____________________________________________________________________________
+bpo::options_description MakeOption()
+{
+    bpo::options_description options("options");
+    options.add_options()
+    //
+    ("help,h", "print this help")
+    //
+    ("redis-uri", bpo::value<std::string>()->default_value("tcp://127.0.0.1:6379"), "URI of redis-server")
+    //
+    ("n-transitions", bpo::value<std::size_t>()->default_value(1000), "number of state transitions per mode");
+    return options;
+}
+
+//_____________________________________________________________________________
+int main(int argc, char* argv[])
+{
+    bpo::variables_map vm;
+    auto ret = ParseCommandLine(argc, argv, MakeOption(), vm);
+    if (ret!=EXIT_SUCCESS) {
+        return ret;
+    }
+
+    const auto nTransitions = vm["n-transitions"].as<std::size_t>();
+    sw::redis::ConnectionOptions connOpts(vm["redis-uri"].as<std::string>());
+    sw::redis::ConnectionPoolOptions poolOpts;
+    poolOpts.size = 3;
+    sw::redis::Redis client(connOpts, poolOpts);
+    client.ping();
+    std::cout << "n transitions = " << nTransitions << std::endl;
+
+    std::mutex mutex;
+    Result sync{"sync", {}};
+    for (auto i = 0u; i < nTransitions; ++i) {
+        const auto t0 = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            WriteState(client, States[i % States.size()]);
+        }
+        sync.latency.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count());
+    }
+
+    auto ctx = std::make_shared<net::io_context>();
+    auto guard = net::make_work_guard(*ctx);
+    std::thread thread([ctx]() {
+        ctx->run();
+    });
+    Result posted{"posted", {}};
+    Result done{"posted (done)", {}};
+    done.latency.resize(nTransitions);
+    for (auto i = 0u; i < nTransitions; ++i) {
+        const auto t0 = std::chrono::steady_clock::now();
+        net::post(*ctx, [&, i, t0]() {
+            std::lock_guard<std::mutex> lock{mutex};
+            WriteState(client, States[i % States.size()]);
+            done.latency[i] = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+        });
+        posted.latency.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count());
+        // the transitions of a device are not back-to-back: let the previous write finish
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+    }
+    guard.reset();
+    thread.join();
+
+    Print(sync);
+    Print(posted);
+    Print(done);
+
+    client.del(StateKey);
+    client.del(HealthKey);
+    return EXIT_SUCCESS;
+}
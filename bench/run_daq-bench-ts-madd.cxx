@@ -0,0 +1,127 @@
+// Benchmark of the time series writes of the metrics plugin.
+// Compares one ts.madd per flush (ts-madd=true) with one ts.add per sample (ts-madd=false)
+// for the 4 series (msg-in, msg-out, bytes-in, bytes-out) of each sub-channel.
+//
+//   daq-bench-ts-madd --redis-uri tcp://127.0.0.1:6379 --n-sub-channels 128 --n-flushes 1000
+//
+// The series are created under bench:ts-madd:<n> and deleted at the end.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include <sw/redis++/redis++.h>
+
+#include "plugins/tools.h"
+
+namespace bpo = boost::program_options;
+
+namespace {
+struct Result {
+    std::string name;
+    std::vector<double> latency; // microseconds per flush
+};
+
+//_____________________________________________________________________________
+void Print(Result &r, std::size_t nSamplesPerFlush)
+{
+    std::sort(r.latency.begin(), r.latency.end());
+    double sum{0};
+    for (auto v : r.latency) {
+        sum += v;
+    }
+    const auto n    = r.latency.size();
+    const auto mean = sum / n;
+    std::cout << std::left << std::setw(8) << r.name << std::right << std::fixed << std::setprecision(1)
+              << " mean = " << std::setw(9) << mean << " us"
+              << ", p50 = " << std::setw(9) << r.latency[n / 2] << " us"
+              << ", p99 = " << std::setw(9) << r.latency[std::min(n - 1, n * 99 / 100)] << " us"
+              << ", samples/s = " << std::setprecision(0) << (nSamplesPerFlush * 1e6 / mean) << std::endl;
+}
+}
+
+//_____________________________________________________________________________
+bpo::options_description MakeOption()
+{
+    bpo::options_description options("options");
+    options.add_options()
+    //
+    ("help,h", "print this help")
+    //
+    ("redis-uri", bpo::value<std::string>()->default_value("tcp://127.0.0.1:6379"), "URI of redis-server")
+    //
+    ("n-sub-channels", bpo::value<std::size_t>()->default_value(128), "number of sub-channels (4 series per sub-channel)")
+    //
+    ("n-flushes", bpo::value<std::size_t>()->default_value(1000), "number of flushes per mode");
+    return options;
+}
+
+//_____________________________________________________________________________
+int main(int argc, char* argv[])
+{
+    bpo::variables_map vm;
+    auto ret = ParseCommandLine(argc, argv, MakeOption(), vm);
+    if (ret!=EXIT_SUCCESS) {
+        return ret;
+    }
+
+    const auto nSubChannels = vm["n-sub-channels"].as<std::size_t>();
+    const auto nFlushes     = vm["n-flushes"].as<std::size_t>();
+    sw::redis::Redis client(vm["redis-uri"].as<std::string>());
+
+    std::vector<std::string> keys;
+    for (auto i = 0u; i < nSubChannels; ++i) {
+        for (const auto &m : {"msg-in", "msg-out", "bytes-in", "bytes-out"}) {
+            keys.push_back("bench:ts-madd:" + std::to_string(i) + ":" + m);
+        }
+    }
+    {
+        auto pipe = client.pipeline();
+        for (const auto &k : keys) {
+            pipe.del(k).command("ts.create", k, "retention", "600000", "duplicate_policy", "last");
+        }
+        pipe.exec();
+    }
+    std::cout << "n series = " << keys.size() << ", n flushes = " << nFlushes << std::endl;
+
+    auto timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    auto run = [&](Result &r, bool madd) {
+        auto pipe = client.pipeline();
+        std::vector<std::string> samples;
+        for (auto i = 0u; i < nFlushes; ++i) {
+            const auto ts = std::to_string(++timestamp);
+            const auto t0 = std::chrono::steady_clock::now();
+            if (madd) {
+                samples.assign({"ts.madd"});
+                for (const auto &k : keys) {
+                    samples.push_back(k);
+                    samples.push_back(ts);
+                    samples.push_back(std::to_string(i));
+                }
+                pipe.command(samples.cbegin(), samples.cend());
+            } else {
+                for (const auto &k : keys) {
+                    pipe.command("ts.add", k, ts, std::to_string(i));
+                }
+            }
+            pipe.exec();
+            r.latency.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count());
+        }
+    };
+
+    Result add{"ts.add", {}};
+    Result madd{"ts.madd", {}};
+    run(add, false);
+    run(madd, true);
+    Print(add, keys.size());
+    Print(madd, keys.size());
+
+    client.del(keys.cbegin(), keys.cend());
+    return EXIT_SUCCESS;
+}
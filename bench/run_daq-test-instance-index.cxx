@@ -0,0 +1,192 @@
+// Scale test of the service-instance-index allocation of the daq_service plugin.
+// Starts n instances concurrently (one thread and one connection per instance), each allocating
+// its index with the script lua::AllocateInstanceIndex, and checks that the indices are 0...n-1
+// without duplicates. Then checks the lease renewal of lua::Heartbeat for lapsed leases.
+// Returns EXIT_SUCCESS if all checks pass.
+//
+//   daq-test-instance-index --redis-uri tcp://127.0.0.1:6379 --n-instances 1000
+//
+// The keys are created under bench:instance-index:* and deleted at the end.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include <sw/redis++/redis++.h>
+
+#include "plugins/LuaScripts.h"
+#include "plugins/tools.h"
+
+namespace bpo = boost::program_options;
+namespace lua = daq::service::lua;
+
+namespace {
+int gNumFailed{0};
+
+const std::string Prefix{"bench:instance-index"};
+const std::vector<std::string> IndexKeys{Prefix + ":index", Prefix + ":lease", Prefix + ":free"};
+const std::string PresencePrefix{Prefix + ":svc-"};
+const std::string PresenceSuffix{":presence"};
+constexpr int Ttl{60}; // sec
+
+//_____________________________________________________________________________
+void Check(bool ok, std::string_view what)
+{
+    std::cout << (ok ? "[ OK ] " : "[FAIL] ") << what << std::endl;
+    if (!ok) {
+        ++gNumFailed;
+    }
+}
+
+//_____________________________________________________________________________
+long long Allocate(sw::redis::Redis &client, const std::string &uuid)
+{
+    // same as Plugin::SetId(): the presence key is set after the allocation
+    const std::vector<std::string> args{uuid, std::to_string(Ttl)};
+    const auto index = client.eval<long long>(lua::AllocateInstanceIndex.data(), IndexKeys.cbegin(), IndexKeys.cend(), args.cbegin(), args.cend());
+    client.set(PresencePrefix + std::to_string(index) + PresenceSuffix, uuid, std::chrono::seconds(Ttl));
+    return index;
+}
+
+//_____________________________________________________________________________
+// returns the lease state of the heartbeat (1: renewed, 2: taken back, 0: lost)
+long long Heartbeat(sw::redis::Redis &client, const std::string &uuid, long long index)
+{
+    const std::vector<std::string> keys{Prefix + ":health", Prefix + ":presence", Prefix + ":state", Prefix + ":updated",
+                                        IndexKeys[0], IndexKeys[1], IndexKeys[2], Prefix + ":prog-options"};
+    const std::vector<std::string> args{std::to_string(Ttl), uuid, "RUNNING", "", "0", std::to_string(index)};
+    std::vector<long long> ret;
+    client.eval(lua::Heartbeat.data(), keys.cbegin(), keys.cend(), args.cbegin(), args.cend(), std::back_inserter(ret));
+    return (ret.size() == 3) ? ret[1] : -1;
+}
+
+//_____________________________________________________________________________
+// the lease expires as if the heartbeat had stalled
+void Lapse(sw::redis::Redis &client, long long index)
+{
+    client.zadd(IndexKeys[1], std::to_string(index), 0);
+}
+
+//_____________________________________________________________________________
+void Cleanup(sw::redis::Redis &client)
+{
+    std::vector<std::string> keys;
+    auto cursor = 0LL;
+    do {
+        cursor = client.scan(cursor, Prefix + ":*", 1000, std::back_inserter(keys));
+    } while (cursor != 0);
+    if (!keys.empty()) {
+        client.del(keys.cbegin(), keys.cend());
+    }
+}
+}
+
+//_____________________________________________________________________________
+bpo::options_description MakeOption()
+{
+    bpo::options_description options("options");
+    options.add_options()
+    //
+    ("help,h", "print this help")
+    //
+    ("redis-uri", bpo::value<std::string>()->default_value("tcp://127.0.0.1:6379"), "URI of redis-server")
+    //
+    ("n-instances", bpo::value<std::size_t>()->default_value(1000), "number of instances started concurrently");
+    return options;
+}
+
+//_____________________________________________________________________________
+int main(int argc, char* argv[])
+{
+    bpo::variables_map vm;
+    auto ret = ParseCommandLine(argc, argv, MakeOption(), vm);
+    if (ret!=EXIT_SUCCESS) {
+        return ret;
+    }
+
+    const auto uri        = vm["redis-uri"].as<std::string>();
+    const auto nInstances = vm["n-instances"].as<std::size_t>();
+    sw::redis::Redis client(uri);
+    Cleanup(client);
+
+    // all instances connect first and allocate at the same time
+    std::vector<long long> indices(nInstances, -1);
+    std::vector<double> latency(nInstances, 0);
+    std::atomic<std::size_t> nReady{0};
+    std::atomic<bool> go{false};
+    std::vector<std::thread> threads;
+    for (auto i = 0u; i < nInstances; ++i) {
+        threads.emplace_back([&, i]() {
+            try {
+                sw::redis::Redis c(uri);
+                c.ping();
+                ++nReady;
+                while (!go) {
+                    std::this_thread::yield();
+                }
+                const auto t0 = std::chrono::steady_clock::now();
+                indices[i] = Allocate(c, "uuid-" + std::to_string(i));
+                latency[i] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+            } catch (const sw::redis::Error &e) {
+                std::cerr << " instance " << i << " : " << e.what() << std::endl;
+                ++nReady;
+            }
+        });
+    }
+    while (nReady < nInstances) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    const auto t0 = std::chrono::steady_clock::now();
+    go = true;
+    for (auto &t : threads) {
+        t.join();
+    }
+    const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    std::cout << nInstances << " instances allocated in " << elapsed << " ms, max latency = "
+              << *std::max_element(latency.cbegin(), latency.cend()) << " ms" << std::endl;
+
+    auto sorted = indices;
+    std::sort(sorted.begin(), sorted.end());
+    auto expected = true;
+    for (auto i = 0u; i < nInstances; ++i) {
+        expected = expected && (sorted[i] == static_cast<long long>(i));
+    }
+    Check(expected, "indices are 0..n-1 without duplicates");
+
+    if (nInstances >= 4) {
+        const auto uuid = [&indices](long long index) {
+            const auto itr = std::find(indices.cbegin(), indices.cend(), index);
+            return "uuid-" + std::to_string(std::distance(indices.cbegin(), itr));
+        };
+        Check(Heartbeat(client, uuid(0), 0) == 1, "heartbeat renews the lease");
+
+        Lapse(client, 1);
+        Check(Heartbeat(client, uuid(1), 1) == 1, "lapsed lease which is not reclaimed yet is renewed");
+
+        // reclaimed by the next allocation and given to the new instance
+        Lapse(client, 2);
+        Check(Allocate(client, "uuid-new") == 2, "lapsed index is given to a new instance");
+        Check(Heartbeat(client, uuid(2), 2) == 0, "heartbeat of the previous owner reports the lost lease");
+        Check(Heartbeat(client, "uuid-new", 2) == 1, "heartbeat of the new owner renews the lease");
+
+        // two lapsed leases: the lower index is given to the new instance, the other one stays in the free list
+        Lapse(client, 0);
+        Lapse(client, 3);
+        Check(Allocate(client, "uuid-new-2") == 0, "lowest lapsed index is given to a new instance");
+        Check(Heartbeat(client, uuid(3), 3) == 2, "index in the free list is taken back by the heartbeat");
+        Check(Allocate(client, "uuid-new-3") == static_cast<long long>(nInstances), "taken back index is not given again");
+    }
+
+    Cleanup(client);
+    std::cout << (gNumFailed == 0 ? "all checks passed" : std::to_string(gNumFailed) + " check(s) failed") << std::endl;
+    return (gNumFailed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,101 @@
+// Test of the Prometheus endpoint of the metrics plugin (metrics-exporter=prometheus).
+// Starts a PrometheusExporter on 127.0.0.1 with a free port, adds samples and scrapes it
+// like a Prometheus server. Returns EXIT_SUCCESS if all checks pass.
+//
+//   daq-test-prometheus-exporter
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include <boost/asio.hpp>
+
+#include "plugins/PrometheusExporter.h"
+
+namespace net = boost::asio;
+
+using daq::service::PrometheusExporter;
+using tcp = net::ip::tcp;
+
+namespace {
+int gNumFailed{0};
+
+//_____________________________________________________________________________
+void Check(bool ok, std::string_view what)
+{
+    std::cout << (ok ? "[ OK ] " : "[FAIL] ") << what << std::endl;
+    if (!ok) {
+        ++gNumFailed;
+    }
+}
+
+//_____________________________________________________________________________
+// returns the whole response (the server closes the connection)
+std::string Request(unsigned short port, const std::string &request)
+{
+    net::io_context ctx;
+    tcp::socket socket(ctx);
+    socket.connect(tcp::endpoint(net::ip::make_address("127.0.0.1"), port));
+    boost::system::error_code ec;
+    net::write(socket, net::buffer(request), ec);
+    std::string response;
+    net::read(socket, net::dynamic_buffer(response), ec);
+    return response;
+}
+}
+
+//_____________________________________________________________________________
+int main()
+{
+    auto ctx = std::make_shared<net::io_context>();
+    auto guard = net::make_work_guard(*ctx);
+    std::thread thread([ctx]() {
+        ctx->run();
+    });
+
+    {
+        PrometheusExporter exporter(ctx, "127.0.0.1", 0);
+        const auto port = exporter.Port();
+        Check(port > 0, "port 0 is bound to a free port (" + std::to_string(port) + ")");
+
+        exporter.Add("ts:dev-0:cpu", {{"data", "cpu"}, {"id", "dev-0"}, {"run_number", "12"}}, 1000, "12.5");
+        exporter.Add("ts:dev-0:thread:7:cpu", {{"data", "thread-cpu"}, {"id", "dev-0"}}, 1000, "3");
+        auto body = Request(port, "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n");
+        Check(body.find("nestdaq_cpu") == std::string::npos, "samples are not exposed before Flush()");
+
+        exporter.Flush();
+        body = Request(port, "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n");
+        Check(body.rfind("HTTP/1.1 200 OK\r\n", 0) == 0, "GET /metrics returns 200");
+        Check(body.find("# TYPE nestdaq_cpu gauge\n") != std::string::npos, "TYPE line");
+        Check(body.find("nestdaq_cpu{ts_key=\"ts:dev-0:cpu\",id=\"dev-0\",run_number=\"12\"} 12.5 1000\n") != std::string::npos,
+              "sample line with labels and timestamp");
+
+        exporter.Remove("ts:dev-0:thread:7:cpu");
+        body = Request(port, "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n");
+        Check(body.find("nestdaq_thread_cpu{") == std::string::npos, "removed series is not exposed");
+        Check(body.find("nestdaq_cpu{") != std::string::npos, "other series are kept after Remove()");
+
+        body = Request(port, "GET /foo HTTP/1.1\r\nHost: localhost\r\n\r\n");
+        Check(body.rfind("HTTP/1.1 404 Not Found\r\n", 0) == 0, "unknown target returns 404");
+
+        // header without the terminating empty line, larger than the limit
+        const std::string large = "GET /metrics HTTP/1.1\r\nX-Padding: " + std::string(2 * PrometheusExporter::MaxRequestSize, 'x');
+        const auto t0 = std::chrono::steady_clock::now();
+        body = Request(port, large);
+        Check(body.empty() && (std::chrono::steady_clock::now() - t0 < std::chrono::seconds(5)),
+              "request larger than MaxRequestSize is closed without a response");
+
+        body = Request(port, "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n");
+        Check(body.rfind("HTTP/1.1 200 OK\r\n", 0) == 0, "endpoint serves after a rejected request");
+    }
+
+    guard.reset();
+    ctx->stop();
+    thread.join();
+    std::cout << (gNumFailed == 0 ? "all checks passed" : std::to_string(gNumFailed) + " check(s) failed") << std::endl;
+    return (gNumFailed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
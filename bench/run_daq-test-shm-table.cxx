@@ -0,0 +1,112 @@
+// Test of the shared memory table of the metrics plugin (metrics-exporter=shm).
+// Writes series with ShmTableExporter and reads the table like the aggregator (daq-metrics-aggregator):
+// removed series free their entries for new series, and rewritten labels are seen by the reader.
+// Returns EXIT_SUCCESS if all checks pass.
+//
+//   daq-test-shm-table
+
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include "plugins/MetricsShmTable.h"
+#include "plugins/ShmTableExporter.h"
+
+using daq::service::MetricsShmTable;
+using daq::service::ShmTableExporter;
+
+namespace {
+int gNumFailed{0};
+
+//_____________________________________________________________________________
+void Check(bool ok, std::string_view what)
+{
+    std::cout << (ok ? "[ OK ] " : "[FAIL] ") << what << std::endl;
+    if (!ok) {
+        ++gNumFailed;
+    }
+}
+
+//_____________________________________________________________________________
+// index of the entry of the key (-1 if not found)
+int Find(const MetricsShmTable &t, const std::string &key)
+{
+    std::string k;
+    std::string labels;
+    uint32_t generation{0};
+    for (auto i = 0u; i < t.Size(); ++i) {
+        if (t.ReadKey(i, k, labels, generation) && (k == key)) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+}
+
+//_____________________________________________________________________________
+int main()
+{
+    const std::string id = "test-shm-table-" + std::to_string(getpid());
+    constexpr uint32_t Capacity{4};
+    {
+        ShmTableExporter exporter(id, Capacity);
+        auto reader = MetricsShmTable::Open(MetricsShmTable::Name(id));
+        Check(reader != nullptr, "table is opened by the reader");
+        if (!reader) {
+            return EXIT_FAILURE;
+        }
+
+        // the table is filled by the series of exited threads
+        for (auto i = 0u; i < Capacity; ++i) {
+            exporter.Add("ts:dev-0:thread:" + std::to_string(i) + ":cpu", {{"data", "thread-cpu"}}, 1000, "1");
+        }
+        exporter.Add("ts:dev-0:cpu", {{"data", "cpu"}}, 1000, "1");
+        Check(Find(*reader, "ts:dev-0:cpu") < 0, "series is dropped when the table is full");
+
+        const auto removed = Find(*reader, "ts:dev-0:thread:1:cpu");
+        exporter.Remove("ts:dev-0:thread:1:cpu");
+        Check(Find(*reader, "ts:dev-0:thread:1:cpu") < 0, "removed series is not in the table");
+
+        std::string key;
+        std::string labels;
+        uint32_t g0{0};
+        reader->ReadKey(removed, key, labels, g0);
+        Check(key.empty(), "entry of the removed series is free");
+
+        exporter.Add("ts:dev-0:cpu", {{"data", "cpu"}, {"run_number", "1"}}, 2000, "12.5");
+        Check(Find(*reader, "ts:dev-0:cpu") == removed, "free entry is reused by a new series");
+        Check(reader->Size() == Capacity, "table does not grow");
+
+        double value{0};
+        int64_t timestamp{0};
+        uint32_t g1{0};
+        reader->Read(removed, value, timestamp, g1);
+        Check((value == 12.5) && (timestamp == 2000), "sample of the new series");
+        Check(g1 != g0, "generation changes when the entry is reused");
+        reader->ReadKey(removed, key, labels, g1);
+        Check(labels == "data=cpu\nrun_number=1\n", "labels of the new series");
+
+        // next run
+        exporter.Add("ts:dev-0:cpu", {{"data", "cpu"}, {"run_number", "2"}}, 3000, "13");
+        uint32_t g2{0};
+        reader->ReadKey(removed, key, labels, g2);
+        Check((g2 != g1) && (labels == "data=cpu\nrun_number=2\n"), "changed labels are rewritten");
+
+        uint32_t g3{0};
+        exporter.Add("ts:dev-0:cpu", {{"data", "cpu"}, {"run_number", "2"}}, 4000, "14");
+        reader->Read(removed, value, timestamp, g3);
+        Check((g3 == g2) && (value == 14), "same labels: only the sample is updated");
+
+        // labels too long: the series is dropped and its entry freed
+        exporter.Add("ts:dev-0:cpu", {{"data", std::string(MetricsShmTable::LabelsSize, 'x')}}, 5000, "15");
+        Check(Find(*reader, "ts:dev-0:cpu") < 0, "series with too long labels is removed");
+        exporter.Add("ts:dev-0:ram", {{"data", "ram"}}, 5000, "1");
+        Check(Find(*reader, "ts:dev-0:ram") == removed, "entry freed by too long labels is reused");
+    }
+    std::cout << (gNumFailed == 0 ? "all checks passed" : std::to_string(gNumFailed) + " check(s) failed") << std::endl;
+    return (gNumFailed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
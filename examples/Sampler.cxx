@@ -3,6 +3,11 @@
 
 #include <fairmq/runFairMQDevice.h>
 
+#include "plugins/ChannelHistogram.h"
+#include "plugins/ChannelQueue.h"
+#include "plugins/CustomMetrics.h"
+#include "plugins/SocketCounters.h"
+
 #include "Sampler.h"
 
 namespace bpo = boost::program_options;
@@ -78,6 +83,16 @@ void Sampler::InitTask()
     fMaxIterations = std::stoull(fConfig->GetProperty<std::string>("max-iterations"));
 
     fNumSubChannels = GetNumSubChannels(fOutputChannelName);
+
+    // socket counters for the metrics plugin (socket-metrics-mode=sample)
+    daq::service::RegisterSocketCounters(*this);
+    // message size and inter-arrival histograms for the metrics plugin
+    fHistograms = daq::service::RegisterChannelHistograms(*this);
+    // queue occupancy and blocked time of Send() for the metrics plugin
+    fQueues = daq::service::RegisterChannelQueues(*this);
+    // custom metrics of this device
+    fMetrics  = daq::service::RegisterCustomMetrics(*this);
+    fNumBytes = &fMetrics->GetCounter("bytes-sent");
 }
 
 //_____________________________________________________________________________
@@ -103,10 +118,15 @@ bool Sampler::ConditionalRun()
 
         LOG(info) << "Sending \"" << txt << "\"";
 
-        if (Send(msg, fOutputChannelName, iSubChannel) < 0) {
+        const auto size = msg->GetSize();
+        if (daq::service::Send(*this, fQueues->Get(fOutputChannelName, iSubChannel), msg, fOutputChannelName, iSubChannel) < 0) {
             LOG(warn) << "failed to send. event:  " << fNumIterations << ", sub channel = " << iSubChannel;
             return false;
         }
+        if (auto h = fHistograms->Get(fOutputChannelName, iSubChannel)) {
+            h->Record(size);
+        }
+        fNumBytes->Add(size);
     }
 
     ++fNumIterations;
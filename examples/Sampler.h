@@ -1,6 +1,7 @@
 #ifndef Examples_Sampler_h
 #define Exapmles_Sampler_h
 
+#include <memory>
 #include <string>
 
 #if __has_include(<fairmq/Device.h>)
@@ -9,6 +10,13 @@
 #include <fairmq/FairMQDevice.h>
 #endif
 
+namespace daq::service {
+class ChannelHistogramRegistry;
+class ChannelQueueRegistry;
+class CustomCounter;
+class CustomMetrics;
+}
+
 class Sampler : public FairMQDevice
 {
 public:
@@ -22,6 +30,10 @@ protected:
     uint64_t fMaxIterations;
     uint64_t fNumIterations;
     int fNumSubChannels;
+    std::shared_ptr<daq::service::ChannelHistogramRegistry> fHistograms;
+    std::shared_ptr<daq::service::ChannelQueueRegistry> fQueues;
+    std::shared_ptr<daq::service::CustomMetrics> fMetrics;
+    daq::service::CustomCounter *fNumBytes{nullptr};
 
     void Init() override;
     void InitTask() override;
@@ -3,6 +3,10 @@
 
 #include <fairmq/runFairMQDevice.h>
 
+#include "plugins/ChannelHistogram.h"
+#include "plugins/ChannelQueue.h"
+#include "plugins/SocketCounters.h"
+
 #include "Sink.h"
 
 static constexpr std::string_view MyClass{"Sink"};
@@ -44,12 +48,22 @@ bool Sink::HandleData(FairMQMessagePtr &msg, int index)
     std::string s(ptr, ptr+msg->GetSize());
     LOG(debug) << __FUNCTION__ << " received = " << s << " [" << index << "] " << fNumMessages;
     ++fNumMessages;
+    if (auto h = fHistograms->Get(fInputChannelName, index)) {
+        h->Record(msg->GetSize());
+    }
     return true;
 }
 
 //_____________________________________________________________________________
 bool Sink::HandleMultipartData(FairMQParts &msgParts, int index)
 {
+    std::size_t size = 0;
+    for (const auto& msg : msgParts) {
+        size += msg->GetSize();
+    }
+    if (auto h = fHistograms->Get(fInputChannelName, index)) {
+        h->Record(size);
+    }
     for (const auto& msg : msgParts) {
         const auto ptr = reinterpret_cast<char*>(msg->GetData());
         std::string s(ptr, ptr+msg->GetSize());
@@ -90,6 +104,12 @@ void Sink::InitTask()
         OnData(fInputChannelName, &Sink::HandleData);
     }
 
+    // socket counters for the metrics plugin (socket-metrics-mode=sample)
+    daq::service::RegisterSocketCounters(*this);
+    // message size and inter-arrival histograms for the metrics plugin
+    fHistograms = daq::service::RegisterChannelHistograms(*this);
+    // waiting time of Receive() for the metrics plugin
+    fQueues = daq::service::RegisterChannelQueues(*this);
 }
 
 //_____________________________________________________________________________
@@ -102,7 +122,7 @@ void Sink::PostRun()
         const auto &isMultipart = fConfig->GetProperty<std::string>(opt::Multipart.data());
         if (isMultipart=="true" || isMultipart=="1") {
             FairMQParts parts;
-            if (Receive(parts, fInputChannelName) <= 0) {
+            if (daq::service::Receive(*this, fQueues->Get(fInputChannelName, 0), parts, fInputChannelName) <= 0) {
                 LOG(debug) << __func__ << " no data received " << nrecv;
                 ++nrecv;
                 if (nrecv>10) {
@@ -115,7 +135,7 @@ void Sink::PostRun()
             }
         } else {
             FairMQMessagePtr msg(NewMessage());
-            if (Receive(msg, fInputChannelName) <= 0) {
+            if (daq::service::Receive(*this, fQueues->Get(fInputChannelName, 0), msg, fInputChannelName) <= 0) {
                 LOG(debug) << __func__ << " no data received " << nrecv;
                 ++nrecv;
                 if (nrecv>10) {
@@ -13,6 +13,11 @@
 #include <fairmq/FairMQDevice.h>
 #endif
 
+namespace daq::service {
+class ChannelHistogramRegistry;
+class ChannelQueueRegistry;
+}
+
 class Sink : public FairMQDevice {
 public:
 
@@ -35,6 +40,8 @@ private:
 
     std::string fInputChannelName;
     uint64_t fNumMessages{0};
+    std::shared_ptr<daq::service::ChannelHistogramRegistry> fHistograms;
+    std::shared_ptr<daq::service::ChannelQueueRegistry> fQueues;
 
 };
 
@@ -0,0 +1,160 @@
+#ifndef DaqService_Plugins_ChannelHistogram_h
+#define DaqService_Plugins_ChannelHistogram_h
+
+// Histograms of message size and inter-arrival time of the device's channel sockets.
+// The device records each message with ChannelHistograms::Record() and exposes the registry
+// to the metrics plugin as a function property (same as "GetSocketCounters()").
+//
+// The histogram is log-linear (HDR-style): values below 2^SubBucketBits are exact, and
+// each power of two above is split into 2^SubBucketBits linear buckets (relative error < 1/16).
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace daq::service {
+
+static constexpr std::string_view GetChannelHistogramsFunction{"GetChannelHistograms()"};
+
+class LogLinearHistogram {
+public:
+    static constexpr int SubBucketBits{4};
+    static constexpr uint64_t SubBucketCount{1ULL << SubBucketBits};
+    static constexpr std::size_t NumBuckets{(64 - SubBucketBits + 1) * SubBucketCount};
+
+    struct Snapshot {
+        std::array<uint64_t, NumBuckets> counts{};
+        uint64_t total{0};
+        uint64_t max{0};
+        // lower bound of the bucket which contains the q-quantile (0 < q <= 1)
+        uint64_t Percentile(double q) const {
+            if (total == 0) {
+                return 0;
+            }
+            auto target = static_cast<uint64_t>(q * total + 0.5);
+            if (target == 0) {
+                target = 1;
+            }
+            uint64_t sum = 0;
+            for (std::size_t i = 0; i < NumBuckets; ++i) {
+                sum += counts[i];
+                if (sum >= target) {
+                    const auto v = LowerBound(i);
+                    return (v < max) ? v : max;
+                }
+            }
+            return max;
+        }
+    };
+
+    static std::size_t Index(uint64_t v) {
+        if (v < SubBucketCount) {
+            return static_cast<std::size_t>(v);
+        }
+        const int msb   = 63 - __builtin_clzll(v);
+        const int shift = msb - SubBucketBits;
+        return static_cast<std::size_t>((shift + 1) * SubBucketCount + ((v >> shift) - SubBucketCount));
+    }
+
+    static uint64_t LowerBound(std::size_t i) {
+        if (i < SubBucketCount) {
+            return i;
+        }
+        const auto shift = i / SubBucketCount - 1;
+        return (SubBucketCount + i % SubBucketCount) << shift;
+    }
+
+    void Record(uint64_t v) {
+        fCounts[Index(v)].fetch_add(1, std::memory_order_relaxed);
+        auto m = fMax.load(std::memory_order_relaxed);
+        while ((v > m) && !fMax.compare_exchange_weak(m, v, std::memory_order_relaxed)) {
+        }
+    }
+
+    // read and reset the counts (called by the metrics plugin once per flush)
+    void Collect(Snapshot &s) {
+        s.total = 0;
+        for (std::size_t i = 0; i < NumBuckets; ++i) {
+            s.counts[i] = fCounts[i].exchange(0, std::memory_order_relaxed);
+            s.total += s.counts[i];
+        }
+        s.max = fMax.exchange(0, std::memory_order_relaxed);
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, NumBuckets> fCounts{};
+    std::atomic<uint64_t> fMax{0};
+};
+
+struct ChannelHistograms {
+    LogLinearHistogram size; // bytes
+    LogLinearHistogram gap;  // nanoseconds between two messages
+
+    void Record(uint64_t bytes) {
+        const auto now  = std::chrono::steady_clock::now().time_since_epoch().count();
+        const auto prev = fLastTime.exchange(now, std::memory_order_relaxed);
+        size.Record(bytes);
+        if (prev != 0) {
+            gap.Record(static_cast<uint64_t>(now - prev));
+        }
+    }
+
+private:
+    std::atomic<int64_t> fLastTime{0};
+};
+
+class ChannelHistogramRegistry {
+public:
+    // key = <channel-name>, value = histograms of the sub-channels
+    using Map = std::map<std::string, std::vector<std::unique_ptr<ChannelHistograms>>>;
+
+    void Add(const std::string &channel, std::size_t nSubChannels) {
+        auto &v = fHistograms[channel];
+        while (v.size() < nSubChannels) {
+            v.push_back(std::make_unique<ChannelHistograms>());
+        }
+    }
+    ChannelHistograms* Get(const std::string &channel, std::size_t index) const {
+        auto itr = fHistograms.find(channel);
+        if ((itr == fHistograms.end()) || (index >= itr->second.size())) {
+            return nullptr;
+        }
+        return itr->second[index].get();
+    }
+    const Map& GetAll() const {
+        return fHistograms;
+    }
+
+private:
+    Map fHistograms;
+};
+
+using ChannelHistogramsFunction_t = std::function<std::shared_ptr<ChannelHistogramRegistry>()>;
+
+//_____________________________________________________________________________
+// Create the histograms of all channels and register "GetChannelHistograms()" as a property of the device.
+// Call this from the device (e.g. in InitTask()), keep the returned registry and
+// call Get(channel, index)->Record(size) for each message.
+template <typename Device>
+inline std::shared_ptr<ChannelHistogramRegistry> RegisterChannelHistograms(Device &device)
+{
+    auto registry = std::make_shared<ChannelHistogramRegistry>();
+    for (const auto &[name, subChannels] : device.fChannels) {
+        registry->Add(name, subChannels.size());
+    }
+    device.GetConfig()->template SetProperty<ChannelHistogramsFunction_t>(GetChannelHistogramsFunction.data(), [registry]() {
+        return registry;
+    });
+    return registry;
+}
+
+} // namespace daq::service
+
+#endif
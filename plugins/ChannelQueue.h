@@ -0,0 +1,168 @@
+#ifndef DaqService_Plugins_ChannelQueue_h
+#define DaqService_Plugins_ChannelQueue_h
+
+// Queue occupancy and backpressure of the device's channel sockets.
+// The device sends and receives with daq::service::Send() / Receive() below (or updates the stats
+// of its own buffers with SetDepth()), and exposes the registry to the metrics plugin as a function
+// property (same as "GetChannelHistograms()").
+//
+// ZeroMQ does not expose the fill level of its queues. Send() first tries without blocking:
+// if the queue is at its high-water mark (sndBufSize), the depth is recorded as sndBufSize and
+// the time until the message is accepted is counted as blocked. Otherwise the depth is recorded as 0.
+// So the depth and the high-water mark of a ZeroMQ channel are binary (0 or sndBufSize): they tell
+// "full" from "not full", not the fill level.
+//
+// The waiting time is measured only in daq::service::Receive(). Devices which receive with the
+// OnData() callbacks (most of them) report 0, which does not mean "not starved".
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace daq::service {
+
+static constexpr std::string_view GetChannelQueuesFunction{"GetChannelQueues()"};
+
+class ChannelQueueStats {
+public:
+    struct Snapshot {
+        int64_t depth{0};
+        int64_t highWater{0};      // max depth since the last snapshot
+        uint64_t sendBlockedNs{0}; // time spent blocked in Send() since the last snapshot
+        uint64_t recvWaitNs{0};    // time spent waiting in Receive() since the last snapshot
+        uint64_t nFull{0};         // number of Send() which found the queue full
+    };
+
+    explicit ChannelQueueStats(int64_t capacity = 0) : fCapacity(capacity) {}
+
+    int64_t Capacity() const {
+        return fCapacity;
+    }
+    void SetDepth(int64_t d) {
+        fDepth.store(d, std::memory_order_relaxed);
+        auto m = fHighWater.load(std::memory_order_relaxed);
+        while ((d > m) && !fHighWater.compare_exchange_weak(m, d, std::memory_order_relaxed)) {
+        }
+    }
+    void AddSendBlocked(uint64_t ns) {
+        fSendBlockedNs.fetch_add(ns, std::memory_order_relaxed);
+        fNumFull.fetch_add(1, std::memory_order_relaxed);
+    }
+    void AddRecvWait(uint64_t ns) {
+        fRecvWaitNs.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    // read and reset (called by the metrics plugin once per sampling interval)
+    void Collect(Snapshot &s) {
+        s.depth         = fDepth.load(std::memory_order_relaxed);
+        s.highWater     = fHighWater.exchange(s.depth, std::memory_order_relaxed);
+        s.sendBlockedNs = fSendBlockedNs.exchange(0, std::memory_order_relaxed);
+        s.recvWaitNs    = fRecvWaitNs.exchange(0, std::memory_order_relaxed);
+        s.nFull         = fNumFull.exchange(0, std::memory_order_relaxed);
+    }
+
+private:
+    int64_t fCapacity{0};
+    std::atomic<int64_t> fDepth{0};
+    std::atomic<int64_t> fHighWater{0};
+    std::atomic<uint64_t> fSendBlockedNs{0};
+    std::atomic<uint64_t> fRecvWaitNs{0};
+    std::atomic<uint64_t> fNumFull{0};
+};
+
+class ChannelQueueRegistry {
+public:
+    // key = <channel-name>, value = stats of the sub-channels
+    using Map = std::map<std::string, std::vector<std::unique_ptr<ChannelQueueStats>>>;
+
+    void Add(const std::string &channel, std::vector<int64_t> capacities) {
+        auto &v = fStats[channel];
+        while (v.size() < capacities.size()) {
+            v.push_back(std::make_unique<ChannelQueueStats>(capacities[v.size()]));
+        }
+    }
+    ChannelQueueStats* Get(const std::string &channel, std::size_t index) const {
+        auto itr = fStats.find(channel);
+        if ((itr == fStats.end()) || (index >= itr->second.size())) {
+            return nullptr;
+        }
+        return itr->second[index].get();
+    }
+    const Map& GetAll() const {
+        return fStats;
+    }
+
+private:
+    Map fStats;
+};
+
+using ChannelQueuesFunction_t = std::function<std::shared_ptr<ChannelQueueRegistry>()>;
+
+//_____________________________________________________________________________
+// Create the stats of all channels and register "GetChannelQueues()" as a property of the device.
+// Call this from the device (e.g. in InitTask()) and keep the returned registry.
+template <typename Device>
+inline std::shared_ptr<ChannelQueueRegistry> RegisterChannelQueues(Device &device)
+{
+    auto registry = std::make_shared<ChannelQueueRegistry>();
+    for (const auto &[name, subChannels] : device.fChannels) {
+        std::vector<int64_t> capacities;
+        for (const auto &ch : subChannels) {
+            capacities.push_back(ch.GetSndBufSize());
+        }
+        registry->Add(name, std::move(capacities));
+    }
+    device.GetConfig()->template SetProperty<ChannelQueuesFunction_t>(GetChannelQueuesFunction.data(), [registry]() {
+        return registry;
+    });
+    return registry;
+}
+
+//_____________________________________________________________________________
+// Device::Send() (Channel::Send()) with the measurement of the queue occupancy and the blocked time.
+// The depth is 0 or sndBufSize (the queue was found full).
+// Msg is FairMQMessagePtr or FairMQParts.
+template <typename Device, typename Msg>
+inline int64_t Send(Device &device, ChannelQueueStats *stats, Msg &msg, const std::string &channel, int index = 0)
+{
+    // fair::mq::TransferCode::timeout
+    static constexpr int64_t Timeout{-2};
+    auto &ch = device.GetChannel(channel, index);
+    if (stats == nullptr) {
+        return ch.Send(msg);
+    }
+    auto ret = ch.Send(msg, 0);
+    if (ret != Timeout) {
+        stats->SetDepth(0);
+        return ret;
+    }
+    stats->SetDepth(stats->Capacity());
+    const auto t0 = std::chrono::steady_clock::now();
+    ret = ch.Send(msg);
+    stats->AddSendBlocked(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count());
+    return ret;
+}
+
+//_____________________________________________________________________________
+// Device::Receive() (Channel::Receive()) with the measurement of the waiting time (time starved by the upstream).
+// The messages delivered to OnData() callbacks are not measured.
+template <typename Device, typename Msg>
+inline int64_t Receive(Device &device, ChannelQueueStats *stats, Msg &msg, const std::string &channel, int index = 0, int timeoutMS = -1)
+{
+    const auto t0 = std::chrono::steady_clock::now();
+    const auto ret = device.GetChannel(channel, index).Receive(msg, timeoutMS);
+    if (stats != nullptr) {
+        stats->AddRecvWait(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count());
+    }
+    return ret;
+}
+
+} // namespace daq::service
+
+#endif
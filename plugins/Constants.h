@@ -13,10 +13,13 @@ static constexpr std::string_view FairMQStatePrefix{"fair-mq-state"};
 static constexpr std::string_view UpdateTimePrefix{"updatedTime"};
 static constexpr std::string_view ProgOptionPrefix{"option"};
 static constexpr std::string_view ServiceInstanceIndexPrefix{"service-instance-index"};
+static constexpr std::string_view ServiceInstanceLeasePrefix{"service-instance-lease"};
+static constexpr std::string_view ServiceInstanceFreePrefix{"service-instance-free"};
 
 static constexpr std::string_view Separator{"separator"};
 static constexpr std::string_view ServiceName{"service-name"};
 static constexpr std::string_view ServiceRegistryUri{"registry-uri"};
+static constexpr std::string_view RedisPoolSize{"redis-pool-size"};
 
 static constexpr std::string_view RunInfoPrefix{"run_info"};
 static constexpr std::string_view RunNumber{"run_number"};
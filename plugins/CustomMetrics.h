@@ -0,0 +1,142 @@
+#ifndef DaqService_Plugins_CustomMetrics_h
+#define DaqService_Plugins_CustomMetrics_h
+
+// Counters, gauges and histograms defined by the device (e.g. events built, bytes compressed).
+// The device registers them by name (e.g. in InitTask()), keeps the returned reference and
+// updates it in the data path. The metrics plugin reads the registry via the function property
+// "GetCustomMetrics()" and publishes ts:<id>:custom:<kind>:<name>[-<stat>] every custom-metrics-interval
+// (<kind> = counter, gauge or histogram, so that metrics of different kinds may have the same name).
+//
+// A counter has one cache-line padded slot per thread (threads are assigned to NumSlots slots
+// round-robin), so Add() is one uncontended relaxed atomic add. A gauge is one padded atomic.
+// A histogram is LogLinearHistogram (see ChannelHistogram.h), whose updates spread over the buckets.
+//
+//   auto metrics = daq::service::RegisterCustomMetrics(*this);
+//   auto &nEvents = metrics->GetCounter("events-built");
+//   ...
+//   nEvents.Add();
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#include "plugins/ChannelHistogram.h"
+
+namespace daq::service {
+
+static constexpr std::string_view GetCustomMetricsFunction{"GetCustomMetrics()"};
+
+class CustomCounter {
+public:
+    static constexpr std::size_t NumSlots{16};
+
+    void Add(uint64_t n = 1) {
+        fSlots[Slot()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+    // sum of all threads (called by the metrics plugin)
+    uint64_t Value() const {
+        uint64_t ret = 0;
+        for (const auto &s : fSlots) {
+            ret += s.value.load(std::memory_order_relaxed);
+        }
+        return ret;
+    }
+
+private:
+    struct alignas(64) PaddedValue {
+        std::atomic<uint64_t> value{0};
+    };
+
+    static std::size_t Slot() {
+        static std::atomic<std::size_t> next{0};
+        thread_local const std::size_t slot = next.fetch_add(1, std::memory_order_relaxed) % NumSlots;
+        return slot;
+    }
+
+    std::array<PaddedValue, NumSlots> fSlots{};
+};
+
+class alignas(64) CustomGauge {
+public:
+    void Set(double v) {
+        fValue.store(v, std::memory_order_relaxed);
+    }
+    void Add(double v) {
+        auto old = fValue.load(std::memory_order_relaxed);
+        while (!fValue.compare_exchange_weak(old, old + v, std::memory_order_relaxed)) {
+        }
+    }
+    double Value() const {
+        return fValue.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<double> fValue{0};
+};
+
+using CustomHistogram = LogLinearHistogram;
+
+class CustomMetrics {
+public:
+    // key = name. the elements are not moved, so that the references stay valid
+    template <typename T>
+    using Map = std::map<std::string, std::unique_ptr<T>, std::less<>>;
+
+    // registration (not for the data path). returns the existing one if the name is already registered
+    CustomCounter& GetCounter(std::string_view name) {
+        return Get(fCounters, name);
+    }
+    CustomGauge& GetGauge(std::string_view name) {
+        return Get(fGauges, name);
+    }
+    CustomHistogram& GetHistogram(std::string_view name) {
+        return Get(fHistograms, name);
+    }
+
+    // f(const Map<CustomCounter>&, const Map<CustomGauge>&, const Map<CustomHistogram>&) (called by the metrics plugin)
+    template <typename F>
+    void Visit(F &&f) {
+        std::lock_guard<std::mutex> lock{fMutex};
+        f(fCounters, fGauges, fHistograms);
+    }
+
+private:
+    template <typename T>
+    T& Get(Map<T> &m, std::string_view name) {
+        std::lock_guard<std::mutex> lock{fMutex};
+        auto itr = m.find(name);
+        if (itr == m.end()) {
+            itr = m.emplace(std::string(name), std::make_unique<T>()).first;
+        }
+        return *itr->second;
+    }
+
+    std::mutex fMutex;
+    Map<CustomCounter> fCounters;
+    Map<CustomGauge> fGauges;
+    Map<CustomHistogram> fHistograms;
+};
+
+using CustomMetricsFunction_t = std::function<std::shared_ptr<CustomMetrics>()>;
+
+//_____________________________________________________________________________
+// Create the registry of custom metrics and register "GetCustomMetrics()" as a property of the device.
+template <typename Device>
+inline std::shared_ptr<CustomMetrics> RegisterCustomMetrics(Device &device)
+{
+    auto registry = std::make_shared<CustomMetrics>();
+    device.GetConfig()->template SetProperty<CustomMetricsFunction_t>(GetCustomMetricsFunction.data(), [registry]() {
+        return registry;
+    });
+    return registry;
+}
+
+} // namespace daq::service
+
+#endif
@@ -1,12 +1,18 @@
 #include <algorithm>
 #include <atomic>
 #include <cerrno>
+#include <condition_variable>
 #include <csignal>
 #include <ctime>
+#include <deque>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <iterator>
+#include <mutex>
 #include <random>
 #include <sstream>
+#include <type_traits>
 #include <vector>
 
 #include <boost/uuid/uuid_io.hpp>
@@ -14,7 +20,6 @@
 #include <boost/property_tree/json_parser.hpp>
 
 #include <sw/redis++/redis++.h>
-#include <sw/redis++/patterns/redlock.h>
 #include <sw/redis++/errors.h>
 
 #include <fairmq/Tools.h>
@@ -23,6 +28,8 @@
 #include "plugins/TopologyConfig.h"
 #include "plugins/Constants.h"
 #include "plugins/Functions.h"
+#include "plugins/LuaScripts.h"
+#include "plugins/RedisConnections.h"
 #include "plugins/tools.h"
 #include "plugins/DaqServicePlugin.h"
 
@@ -84,6 +91,9 @@ auto PluginProgramOptions() -> fair::mq::Plugin::ProgOptions
     //
     (ServiceRegistryUri.data(), bpo::value<std::string>()->default_value("tcp://127.0.0.1:6379/0"), "DAQ service registry's URI")
     //
+    (RedisPoolSize.data(),      bpo::value<std::size_t>()->default_value(3),
+     "Size of the Redis connection pool shared by the plugins of this process (daq_service, metrics, parameter_config)")
+    //
     (Separator.data(),          bpo::value<std::string>()->default_value(":"), "separator character for key space name")
     //
     (MaxTtl.data(),             bpo::value<long long>()->default_value(5), "max TTL (time-to-live) in second for keys")
@@ -235,24 +245,45 @@ Plugin::Plugin(std::string_view name,
         return fTopology->GetPeerStateOfConnectChannels();
     });
 
+    // the program options are sent only when they are changed (the snapshot is taken in Register())
+    SubscribeToPropertyChangeAsString([this](const std::string &key, std::string) {
+        try {
+            if (fProgOptions.Update(key)) {
+                Post([this]() {
+                    WriteProgOptions();
+                });
+            }
+        } catch (const std::exception &e) {
+            LOG(error) << MyClass << " exception during property change (key = " << key << "): " << e.what();
+        }
+    });
+
     LOG(warn) << MyClass << " SubscribeToDeviceStateChange()";
     SubscribeToDeviceStateChange([this](DeviceState newState) {
         try {
+            const auto t0 = std::chrono::steady_clock::now();
             auto stateName = GetStateName(newState);
             LOG(info) << MyClass << " state : " << stateName;
             fStateQueue.Push(newState);
 
-            {
+            // the registry is updated in the io_context thread, so that the transition does not wait for redis.
+            // the terminal state is written synchronously (after the pending updates), before the destructor runs.
+            Post([this, stateName]() {
                 std::lock_guard<std::mutex> lock{fMutex};
-                auto pipe = fClient->pipeline();
+                auto pipe = fClient->pipeline(false);
                 pipe.setex(fFairMQStateKey, fMaxTtl, stateName)
                 .hset(fHealth->key, "fair:mq:state", stateName)
                 .expire(fHealth->key, fMaxTtl);
                 pipe.exec();
+            }, newState == DeviceState::Exiting);
+            if (newState == DeviceState::Running) {
+                // the device reads the run number in PreRun()/Run(), which are called after this callback
+                ReadRunNumber();
+            } else {
+                Post([this]() {
+                    ReadRunNumber();
+                });
             }
-
-            WriteProgOptions();
-            ReadRunNumber();
             const auto& v = boost::to_lower_copy(GetProperty<std::string>(EnableUds.data()));
             fTopology->EnableUds((v=="1") || (v=="true"));
             switch (newState) {
@@ -273,6 +304,8 @@ Plugin::Plugin(std::string_view name,
             default:
                 break;
             }
+            LOG(debug) << MyClass << " state change handled in "
+                       << std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0).count() << " us";
         } catch (const std::exception &e) {
             LOG(error) << MyClass << " exception during device state change: " << e.what();
         } catch (...) {
@@ -302,6 +335,7 @@ Plugin::Plugin(std::string_view name,
 Plugin::~Plugin()
 {
     UnsubscribeFromDeviceStateChange();
+    UnsubscribeFromPropertyChangeAsString();
     LOG(warn) << MyClass << " UnsubscribeFromDeviceStateChange()";
     auto state = GetCurrentDeviceState();
     if (state==DeviceState::Exiting) {
@@ -310,7 +344,14 @@ Plugin::~Plugin()
     }
     fPluginShutdownRequested = true;
 //  std::this_thread::sleep_for(std::chrono::microseconds(1000000));
-    fContext->stop();
+    if (fContext) {
+        // the posted registry updates are executed (not dropped) before Unregister(): cancel the heartbeat timer
+        // in the io_context thread and let run() return when the queue is empty
+        net::post(*fContext, [this]() {
+            fTimer.reset();
+        });
+        fWorkGuard.reset();
+    }
 
     if (fTimerThread.joinable()) {
         LOG(debug) << " wait for join: timer thread";
@@ -650,6 +691,36 @@ void Plugin::ChangeDeviceStateBySingleCommand(std::string_view cmd)
 
 }
 
+//_____________________________________________________________________________
+void Plugin::Post(std::function<void()> f, bool wait)
+{
+    auto task = [f = std::move(f)]() {
+        try {
+            f();
+        } catch (const std::exception &e) {
+            LOG(error) << MyClass << " exception in registry update: " << e.what();
+        } catch (...) {
+            LOG(error) << MyClass << " exception in registry update: unknown exception";
+        }
+    };
+    if (!fContext || fContext->stopped()) {
+        // not registered yet or shut down
+        task();
+        return;
+    }
+    if (!wait) {
+        net::post(*fContext, std::move(task));
+        return;
+    }
+    // executed after the tasks posted before (not called from the io_context thread)
+    std::promise<void> done;
+    net::post(*fContext, [&task, &done]() {
+        task();
+        done.set_value();
+    });
+    done.get_future().wait();
+}
+
 //_____________________________________________________________________________
 void Plugin::ReadRunNumber()
 {
@@ -682,7 +753,8 @@ void Plugin::Register()
 
     try {
         {
-            fClient = std::make_shared<sw::redis::Redis>(registryUri);
+            fConnections = GetRedisConnections(*this, registryUri);
+            fClient      = fConnections->GetClient();
             fClient->command("client", "setname", join({TopPrefix.data(), fServiceName, fId}, fSeparator));
         }
         SetId();
@@ -706,10 +778,10 @@ void Plugin::Register()
             fContext = std::make_shared<net::io_context>();
             fWorkGuard = std::make_unique<work_guard_t>(std::move(net::make_work_guard(*fContext)));
             // start io_context::run() in another thread
+            // joined by the destructor after the posted tasks are done
             fTimerThread = std::thread([this]() {
                 fContext->run();
             });
-            fTimerThread.detach();
             LOG(debug) << " thread start";
 
             LOG(debug) << " timer start " << (fTtlUpdateInterval * 1000)  << " msec";
@@ -730,7 +802,7 @@ void Plugin::Register()
         {
             // pipeline
             std::lock_guard<std::mutex> lock{fMutex};
-            auto pipe = fClient->pipeline();
+            auto pipe = fClient->pipeline(false);
             pipe.hset(fHealth->key,
             {   std::make_pair("instanceID",  fId),
                 std::make_pair("uuid",        boost::uuids::to_string(fUuid)),
@@ -747,6 +819,9 @@ void Plugin::Register()
             fRegisteredKeys.insert(fHealth->key);
         }
 
+        if (fProgOptions.Empty()) {
+            SnapshotProgOptions();
+        }
         WriteProgOptions();
         fRegisteredKeys.insert(fProgOptionKeyName);
 
@@ -768,21 +843,62 @@ void Plugin::ResetTtl()
     const auto &[uptimeNsec, updatedTime] = update_date(fHealth->createdTimeSystem, fHealth->createdTime);
     const auto & lastChecked = to_date(updatedTime);
 
+    // one script call per heartbeat regardless of the number of keys of this instance
+    // (the index keys are placeholders if the id is given by the option)
+    const auto &indexKeys = fInstanceIndexKeys.empty() ? std::vector<std::string>(3, fHealth->key) : fInstanceIndexKeys;
+    std::vector<std::string> keys{fHealth->key, fPresence->key, fFairMQStateKey, fUpdateTimeKey,
+                                  indexKeys[0], indexKeys[1], indexKeys[2],
+                                  fProgOptionKeyName};
+    const std::vector<std::string> args{
+        std::to_string(fMaxTtl),
+        boost::uuids::to_string(fUuid),
+        GetStateName(GetCurrentDeviceState()),
+        lastChecked,
+        std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(uptimeNsec).count()),
+        fInstanceIndex};
+
     std::lock_guard<std::mutex> lock{fMutex};
-    auto pipe = fClient->pipeline();
-    pipe.hset(fHealth->key,
-    {   std::make_pair("updatedTime", lastChecked),
-        std::make_pair("uptime", std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(uptimeNsec).count())),
-    })
-    .setex(fPresence->key, fMaxTtl, boost::uuids::to_string(fUuid))
-    .setex(fFairMQStateKey, fMaxTtl, GetStateName(GetCurrentDeviceState()))
-    .setex(fUpdateTimeKey, fMaxTtl, lastChecked)
-    .expire(fHealth->key, fMaxTtl)
-    .expire(fProgOptionKeyName, fMaxTtl);
     if (fTopology) {
-        fTopology->ResetTtl(pipe);
+        fTopology->AppendRegisteredKeys(keys);
+    }
+    try {
+        if (fHeartbeatSha.empty()) {
+            fHeartbeatSha = fClient->script_load(lua::Heartbeat.data());
+        }
+        // {number of refreshed keys, lease, options}
+        std::vector<long long> ret;
+        try {
+            fClient->evalsha(fHeartbeatSha, keys.cbegin(), keys.cend(), args.cbegin(), args.cend(), std::back_inserter(ret));
+        } catch (const sw::redis::ReplyError &e) {
+            if (std::string_view(e.what()).find("NOSCRIPT") == std::string_view::npos) {
+                throw;
+            }
+            // script cache of the server is flushed (e.g. restart)
+            fHeartbeatSha = fClient->script_load(lua::Heartbeat.data());
+            ret.clear();
+            fClient->evalsha(fHeartbeatSha, keys.cbegin(), keys.cend(), args.cbegin(), args.cend(), std::back_inserter(ret));
+        }
+        if (ret.size() == 3) {
+            if (ret[1] == 2) {
+                LOG(warn) << MyClass << " lease of service-instance-index " << fInstanceIndex << " had lapsed (heartbeat stalled). taken back";
+            } else if (ret[1] == 0) {
+                // the id can not be changed while the device is running
+                LOG(error) << MyClass << " lease of service-instance-index " << fInstanceIndex
+                           << " had lapsed and the index has been given to another instance. id " << fId << " is duplicated";
+            }
+            if ((ret[2] == 0) && !fProgOptions.Empty()) {
+                // only the changes are sent by WriteProgOptions(): the whole hash is written again after it has been lost
+                // (server restart, TTL lapse during a stall). posted, since fMutex is held here
+                LOG(warn) << MyClass << " " << fProgOptionKeyName << " does not exist. write all program options again";
+                fProgOptions.MarkAllDirty();
+                Post([this]() {
+                    WriteProgOptions();
+                });
+            }
+        }
+    } catch (const sw::redis::Error &e) {
+        LOG(error) << MyClass << " " << __FUNCTION__ << " redis error : " << e.what();
     }
-    pipe.exec();
 }
 
 //_____________________________________________________________________________
@@ -875,65 +991,24 @@ void Plugin::SetId()
         fId = GetProperty<std::string>("id");
     }
     if (fId.empty() && !fServiceName.empty()) {
+        // one atomic script call: reclaim expired indices and take the lowest free one
+        LOG(debug) << "'id' (instance id) is empty. calculate service-instance-index";
+        fInstanceIndexKeys = {join({TopPrefix.data(), ServiceInstanceIndexPrefix.data(), fServiceName}, fSeparator),
+                              join({TopPrefix.data(), ServiceInstanceLeasePrefix.data(), fServiceName}, fSeparator),
+                              join({TopPrefix.data(), ServiceInstanceFreePrefix.data(),  fServiceName}, fSeparator)};
+        const std::vector<std::string> args{boost::uuids::to_string(fUuid), std::to_string(fMaxTtl)};
         while (true) {
             try {
-                sw::redis::RedMutex mtx(fClient, "resource");
-                std::unique_lock<sw::redis::RedMutex> redLock(mtx, std::defer_lock);
-                if (redLock.try_lock()) {
-                    LOG(debug) << "got lock:  " << fUuid;
-                    auto presenceKeys = scan(*fClient, {TopPrefix.data(), fServiceName, "*", PresencePrefix.data()}, fSeparator);
-                    std::unordered_set<std::string> uuidList; // existing uuids
-
-                    if (!presenceKeys.empty()) {
-                        fClient->mget(presenceKeys.cbegin(), presenceKeys.cend(), std::inserter(uuidList, uuidList.begin()));
-                    }
-                    std::string key = join({TopPrefix.data(), ServiceInstanceIndexPrefix.data(), fServiceName}, fSeparator);
-
-                    std::unordered_map<std::string, std::string> hashIndexToUuid;
-                    LOG(debug) << "'id' (instance id) is empty. calculate service-instance-index";
-                    fClient->hgetall(key, std::inserter(hashIndexToUuid, hashIndexToUuid.begin()));
-                    auto myUuid = boost::uuids::to_string(fUuid);
-                    std::vector<std::string> indexExpired;
-                    std::string myIndex;
-                    for (const auto &[index, uuid] : hashIndexToUuid) {
-                        if (uuidList.count(uuid)==0) {
-                            LOG(warn) << " expired " << index << " " << uuid;
-                            indexExpired.emplace_back(index);
-                        } else if (uuid == myUuid) {
-                            myIndex = index;
-                            LOG(debug) << " same uuid is found. reuse the service instance-index: " << myIndex;
-                        }
-                    }
-                    if (!indexExpired.empty()) {
-                        fClient->hdel(key, indexExpired.cbegin(), indexExpired.cend());
-                    }
-                    LOG(debug) << " number of expired uuids " << indexExpired.size();
-
-                    if (myIndex.empty()) {
-                        for (auto index=0; ; ++index) {
-                            myIndex = std::to_string(index);
-                            if (fClient->hsetnx(key, myIndex, myUuid)) {
-                                fRegisteredHashes.insert({key, myIndex});
-                                fId = fServiceName + "-" + myIndex;
-                                fPresence->key = join({TopPrefix.data(), fServiceName, fId, PresencePrefix.data()}, fSeparator);
-                                fClient->setex(fPresence->key, fMaxTtl, boost::uuids::to_string(fUuid));
-                                fRegisteredKeys.insert(fPresence->key);
-                                LOG(debug) << " service instance-index: " << myIndex << " for uuid = " << fUuid;
-                                break;
-                            }
-                        }
-                    }
-                }
-
-                if (redLock.owns_lock()) {
-                    LOG(debug) << "unlock:  " << fUuid;
-                    redLock.unlock();
-                    break;
-                } else {
-                    //LOG(debug) << "extend lock:  " << fUuid;
-                    //redLock.extend_lock(std::chrono::milliseconds(30000));
-                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                }
+                const auto index = fClient->eval<long long>(lua::AllocateInstanceIndex.data(),
+                                   fInstanceIndexKeys.cbegin(), fInstanceIndexKeys.cend(), args.cbegin(), args.cend());
+                fInstanceIndex = std::to_string(index);
+                fId = fServiceName + "-" + fInstanceIndex;
+                fPresence->key = join({TopPrefix.data(), fServiceName, fId, PresencePrefix.data()}, fSeparator);
+                // the presence key depends on the index, so it is not written by the script (undeclared key)
+                fClient->set(fPresence->key, args[0], std::chrono::seconds(fMaxTtl));
+                fRegisteredKeys.insert(fPresence->key);
+                LOG(debug) << " service instance-index: " << fInstanceIndex << " for uuid = " << fUuid;
+                break;
             } catch (const sw::redis::Error& e) {
                 LOG(error) << " caught exception (redis++) : " << e.what();
             } catch (const std::exception& e) {
@@ -941,6 +1016,7 @@ void Plugin::SetId()
             } catch (...) {
                 LOG(error) << " caught exception : unknown";
             }
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
         }
         SetProperty("id", fId);
     }
@@ -977,83 +1053,99 @@ void Plugin::SetProcessName()
 }
 
 //_____________________________________________________________________________
-void Plugin::SubscribeToDaqCommand()
+void Plugin::HandleDaqCommand(const std::string &msg)
 {
-    LOG(debug) << " create a sbuscriber. ";
-    auto sub = fClient->subscriber();
-
-    // set callback functions.
-    sub.on_message([this](auto channel, auto msg) {
-        // process message of MESSAGE type.
-        LOG(debug) << MyClass << " on_message(MESSAGE): channel = " << channel << " msg = " << msg;
-        if (CommandChannelName.data()!=channel) {
+    const auto& obj = to_json(msg);
+    const auto& cmd = obj. template get_optional<std::string>("command");
+    if (!cmd) {
+        LOG(error) << MyClass << " on_message(MESSAGE): missing command";
+        return;
+    }
+    if (*cmd == "change_state") {
+        const auto& val = obj. template get_optional<std::string>("value");
+        std::unordered_set<std::string> services;
+        for (const auto& x : obj.get_child("services")) {
+            services.emplace(x.second. template get_value<std::string>());
+        }
+        std::unordered_set<std::string> instances;
+        for (const auto& x : obj.get_child("instances")) {
+            instances.emplace(x.second. template get_value<std::string>());
+        }
+        if (!val) {
+            LOG(error) << MyClass << " on_message() change_state : new state is not specified.";
             return;
         }
-        const auto& obj = to_json(msg);
-        const auto& cmd = obj. template get_optional<std::string>("command");
-        if (!cmd) {
-            LOG(error) << MyClass << " on_message(MESSAGE): missing command";
+        if (services.empty()) {
+            LOG(error) << MyClass << " on_message() change_state : service is not specified.";
             return;
         }
-        if (*cmd == "change_state") {
-            const auto& val = obj. template get_optional<std::string>("value");
-            std::unordered_set<std::string> services;
-            for (const auto& x : obj.get_child("services")) {
-                services.emplace(x.second. template get_value<std::string>());
-            }
-            std::unordered_set<std::string> instances;
-            for (const auto& x : obj.get_child("instances")) {
-                instances.emplace(x.second. template get_value<std::string>());
-            }
-            if (!val) {
-                LOG(error) << MyClass << " on_message() change_state : new state is not specified.";
-                return;
-            }
-            if (services.empty()) {
-                LOG(error) << MyClass << " on_message() change_state : service is not specified.";
-                return;
-            }
-            if (instances.empty()) {
-                LOG(error) << MyClass << " on_message() change_state : instance is not specified.";
-                return;
+        if (instances.empty()) {
+            LOG(error) << MyClass << " on_message() change_state : instance is not specified.";
+            return;
+        }
+        bool isSingleCommand = false; // TO DO
+        const std::string longInstanceId = daq::service::join({fServiceName, fId}, fSeparator);
+        if ((services.count("all")>0) ||
+                ((services.count(fServiceName)>0) && ((instances.count("all")>0) || (instances.count(longInstanceId)>0)))) {
+            if (isSingleCommand) {
+                ChangeDeviceStateBySingleCommand(*val);
+            } else {
+                ChangeDeviceStateByMultiCommand(*val);
             }
-            bool isSingleCommand = false; // TO DO
-            const std::string longInstanceId = daq::service::join({fServiceName, fId}, fSeparator);
-            if ((services.count("all")>0) ||
-                    ((services.count(fServiceName)>0) && ((instances.count("all")>0) || (instances.count(longInstanceId)>0)))) {
-                if (isSingleCommand) {
-                    ChangeDeviceStateBySingleCommand(*val);
-                } else {
-                    ChangeDeviceStateByMultiCommand(*val);
-                }
-
-                // any state Exiting by exiting SubscribeToDaqCommand() and calling RunShutdownSequence() in the state control thread
-                if ((*val==daq::command::Exit) ||
-                        (*val==daq::command::Quit) ||
-                        (*val==fairmq::command::End)) {
-                    fPluginShutdownRequested = true;
-                }
+
+            // any state Exiting by exiting SubscribeToDaqCommand() and calling RunShutdownSequence() in the state control thread
+            if ((*val==daq::command::Exit) ||
+                    (*val==daq::command::Quit) ||
+                    (*val==fairmq::command::End)) {
+                fPluginShutdownRequested = true;
             }
         }
-    });
-    sub.subscribe(CommandChannelName.data());
+    }
+}
+
+//_____________________________________________________________________________
+void Plugin::SubscribeToDaqCommand()
+{
+    LOG(debug) << " subscribe to " << CommandChannelName << " (shared subscriber)";
+    // messages are handed over from the shared subscriber thread and processed in this (state control) thread
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<std::string> messages;
+    uint64_t id{0};
+    if (fConnections) {
+        id = fConnections->Subscribe(CommandChannelName.data(), [&mtx, &cv, &messages](const auto &channel, const auto &msg) {
+            LOG(debug) << MyClass << " on_message(MESSAGE): channel = " << channel << " msg = " << msg;
+            {
+                std::lock_guard<std::mutex> lock{mtx};
+                messages.push_back(msg);
+            }
+            cv.notify_one();
+        });
+    }
 
     while (!fPluginShutdownRequested) {
+        std::string msg;
+        {
+            std::unique_lock<std::mutex> lock{mtx};
+            if (!cv.wait_for(lock, std::chrono::milliseconds(100), [&messages]() {
+            return !messages.empty();
+            })) {
+                continue;
+            }
+            msg = std::move(messages.front());
+            messages.pop_front();
+        }
         try {
-            sub.consume();
-        } catch (const sw::redis::TimeoutError &e) {
-            // try again.
-        } catch (const sw::redis::Error &e) {
-            LOG(error) << MyClass << "::" << __func__ << ": error in consume(): " << e.what();
-            break;
+            HandleDaqCommand(msg);
         } catch (const std::exception& e) {
-            LOG(error) << MyClass << "::" << __func__ << ": error in consume(): " << e.what();
-            break;
+            LOG(error) << MyClass << "::" << __func__ << ": error in command: " << e.what();
         } catch (...) {
             LOG(error) << MyClass << "::" << __func__ << ": unknown exception";
-            break;
         }
     }
+    if (fConnections) {
+        fConnections->Unsubscribe(id);
+    }
     LOG(debug) << " " << __func__ << " exit.";
 }
 
@@ -1073,6 +1165,13 @@ void Plugin::Unregister()
             LOG(debug) << " delete redis hash. key = " << key << ", field = " << field;
         }
         fRegisteredHashes.clear();
+        if (!fInstanceIndex.empty()) {
+            // the index is reused by the next instance without waiting for the lease to expire
+            const std::vector<std::string> args{fInstanceIndex, boost::uuids::to_string(fUuid)};
+            fClient->eval<long long>(lua::ReleaseInstanceIndex.data(),
+                                     fInstanceIndexKeys.cbegin(), fInstanceIndexKeys.cend(), args.cbegin(), args.cend());
+            LOG(debug) << " release service instance-index: " << fInstanceIndex;
+        }
     } catch (const sw::redis::Error &e) {
         LOG(error) << " UnRegister failed (redis error): " << e.what();
     } catch (const std::exception &e) {
@@ -1083,35 +1182,65 @@ void Plugin::Unregister()
 }
 
 //_____________________________________________________________________________
-void Plugin::WriteProgOptions()
+template <typename T>
+void Plugin::AddProgOption(std::string_view key)
 {
-    std::lock_guard<std::mutex> lock{fMutex};
-    auto pipe = fClient->pipeline();
-    pipe.hset(fProgOptionKeyName,
-    {   std::make_pair("severity",            GetProperty<std::string>("severity")),
-        std::make_pair("file-severity",       GetProperty<std::string>("file-severity")),
-        std::make_pair("verbosity",           GetProperty<std::string>("verbosity")),
-        std::make_pair("color",               std::to_string(GetProperty<bool>("color"))),
-        std::make_pair("log-to-file",         GetProperty<std::string>("log-to-file")),
-        std::make_pair("id",                  GetProperty<std::string>("id")),
-        std::make_pair("io-threads",          std::to_string(GetProperty<int>("io-threads"))),
-        std::make_pair("transport",           GetProperty<std::string>("transport")),
-        std::make_pair("network-interface",   GetProperty<std::string>("network-interface")),
-        std::make_pair("init-timeout",        std::to_string(GetProperty<int>("init-timeout"))),
-        std::make_pair("shm-segment-size",    std::to_string(GetProperty<std::size_t>("shm-segment-size"))),
-        std::make_pair("shm-allocation",      GetProperty<std::string>("shm-allocation")),
-        std::make_pair("shm-monitor",         std::to_string(GetProperty<bool>("shm-monitor"))),
-        std::make_pair("shm-mlock-segment",   std::to_string(GetProperty<bool>("shm-mlock-segment"))),
-        std::make_pair("shm-zero-segment",    std::to_string(GetProperty<bool>("shm-zero-segment"))),
-        std::make_pair("shm-throw-bad-alloc", std::to_string(GetProperty<bool>("shm-throw-bad-alloc"))),
+    fProgOptions.Add(key.data(), [this, key]() {
+        if constexpr (std::is_same_v<std::string, T>) {
+            return GetProperty<std::string>(key.data());
+        } else {
+            return std::to_string(GetProperty<T>(key.data()));
+        }
+    });
+}
+
+//_____________________________________________________________________________
+void Plugin::SnapshotProgOptions()
+{
+    AddProgOption<std::string>("severity");
+    AddProgOption<std::string>("file-severity");
+    AddProgOption<std::string>("verbosity");
+    AddProgOption<bool>("color");
+    AddProgOption<std::string>("log-to-file");
+    AddProgOption<std::string>("id");
+    AddProgOption<int>("io-threads");
+    AddProgOption<std::string>("transport");
+    AddProgOption<std::string>("network-interface");
+    AddProgOption<int>("init-timeout");
+    AddProgOption<std::size_t>("shm-segment-size");
+    AddProgOption<std::string>("shm-allocation");
+    AddProgOption<bool>("shm-monitor");
+    AddProgOption<bool>("shm-mlock-segment");
+    AddProgOption<bool>("shm-zero-segment");
+    AddProgOption<bool>("shm-throw-bad-alloc");
 #if 0 // This option was used, and it is no longer useed in FairMQ 1.8.
-        std::make_pair("ofi-size-hint",       std::to_string(GetProperty<std::size_t>("ofi-size-hint"))),
+    AddProgOption<std::size_t>("ofi-size-hint");
 #endif
-        std::make_pair("rate",                std::to_string(GetProperty<float>("rate"))),
-        std::make_pair("session",             GetProperty<std::string>("session")),
-    })
-    .expire(fProgOptionKeyName, fMaxTtl);
+    AddProgOption<float>("rate");
+    AddProgOption<std::string>("session");
 }
+
+//_____________________________________________________________________________
+void Plugin::WriteProgOptions()
+{
+    // all fields at the first call (Register()), then only the fields changed since the last call.
+    // the TTL is renewed by the heartbeat.
+    const auto changes = fProgOptions.TakeChanges();
+    if (changes.empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock{fMutex};
+    try {
+        auto pipe = fClient->pipeline(false);
+        pipe.hset(fProgOptionKeyName, changes.cbegin(), changes.cend())
+        .expire(fProgOptionKeyName, fMaxTtl)
+        .exec();
+    } catch (const sw::redis::Error &e) {
+        fProgOptions.MarkDirty(changes);
+        LOG(error) << MyClass << " " << __FUNCTION__ << " redis error : " << e.what();
+    }
+}
+
 //_____________________________________________________________________________
 void Plugin::WriteStartTime()
 {
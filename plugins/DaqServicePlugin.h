@@ -8,6 +8,7 @@
 #include <unistd.h>
 
 #include <chrono>
+#include <functional>
 #include <initializer_list>
 #include <memory>
 //#include <mutex>
@@ -25,6 +26,7 @@
 #include <fairmq/Plugin.h>
 #include <fairmq/StateQueue.h>
 
+#include "plugins/ProgOptionsSnapshot.h"
 #include "plugins/Timer.h"
 
 // forward declaration
@@ -47,6 +49,7 @@ struct Health {
 //  std::chrono::system_clock::time_point updatedTime;
 };
 
+class RedisConnections;
 class TopologyConfig;
 
 class Plugin : public fair::mq::Plugin
@@ -84,8 +87,14 @@ public:
     }
 
 private:
+    template <typename T>
+    void AddProgOption(std::string_view key);
     void ChangeDeviceStateByMultiCommand(std::string_view cmd);
     void ChangeDeviceStateBySingleCommand(std::string_view cmd);
+    void HandleDaqCommand(const std::string &msg);
+    // run f in the io_context thread (the thread of the TTL timer). exceptions are logged.
+    // with wait = true, returns after f (and the tasks posted before) has been executed
+    void Post(std::function<void()> f, bool wait = false);
     void ReadRunNumber();
     void Register();
     void ResetTtl();
@@ -94,6 +103,7 @@ private:
     void SetCurrentWorkingDirectory();
     void SetId();
     void SetProcessName();
+    void SnapshotProgOptions();
     void SubscribeToDaqCommand();
     void Unregister();
     void WriteProgOptions();
@@ -108,6 +118,7 @@ private:
     boost::uuids::uuid fUuid;
     std::string fId; // instance id configured by command line option or uuid
     std::string fServiceName;
+    std::shared_ptr<RedisConnections> fConnections; // shared with the other plugins of this process
     std::shared_ptr<sw::redis::Redis> fClient;
     std::unordered_set<std::string> fRegisteredKeys;
     std::unordered_map<std::string, std::string> fRegisteredHashes;
@@ -117,6 +128,11 @@ private:
     std::string fFairMQStateKey;
     std::string fUpdateTimeKey;
     std::string fProgOptionKeyName;
+    ProgOptionsSnapshot fProgOptions;
+    std::string fHeartbeatSha; // sha1 of lua::Heartbeat (script load)
+    // service-instance-index allocated by lua::AllocateInstanceIndex (empty if id is given by the option)
+    std::string fInstanceIndex;
+    std::vector<std::string> fInstanceIndexKeys; // index hash, leases and free list
     long long fMaxTtl;
     long long fTtlUpdateInterval;
 
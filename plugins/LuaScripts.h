@@ -0,0 +1,210 @@
+#ifndef DaqService_Plugins_LuaScripts_h
+#define DaqService_Plugins_LuaScripts_h
+
+// Lua scripts executed on the redis-server (EVAL)
+
+#include <string_view>
+
+namespace daq::service::lua {
+
+//_____________________________________________________________________________
+// Delete the metrics fields of expired instances. The cost is O(expired fields): the expired instances are
+// found in the sorted set, and their fields in the field index of each instance.
+// The field indices and the hashes listed in them are derived from ARGV (not declared in KEYS),
+// so all metrics keys must be on one node.
+// KEYS[1]    : sorted set of instances (score = last update in msec since epoch)
+// KEYS[2...] : hashes whose field is the instance id
+// ARGV[1]    : threshold in msec since epoch (instances updated before this are expired)
+// ARGV[2]    : prefix of the field index (set of "<key>\t<field>", key = prefix .. id)
+// ARGV[3]    : max number of instances deleted in this call
+// returns {number of deleted instances, number of deleted fields}
+static constexpr std::string_view DeleteExpiredFields{R"(
+local ids = redis.call('ZRANGEBYSCORE', KEYS[1], '-inf', '(' .. ARGV[1], 'LIMIT', 0, tonumber(ARGV[3]))
+local n = 0
+for _, id in ipairs(ids) do
+    for i = 2, #KEYS do
+        n = n + redis.call('HDEL', KEYS[i], id)
+    end
+    local index = ARGV[2] .. id
+    for _, e in ipairs(redis.call('SMEMBERS', index)) do
+        local p = string.find(e, '\t', 1, true)
+        if p then
+            n = n + redis.call('HDEL', string.sub(e, 1, p - 1), string.sub(e, p + 1))
+        end
+    end
+    redis.call('DEL', index)
+    redis.call('ZREM', KEYS[1], id)
+end
+return {#ids, n}
+)"};
+
+//_____________________________________________________________________________
+// Create time series (RedisTimeSeries) and their compaction rules in one call. Idempotent.
+// KEYS[1...] : ts keys
+// ARGV[1]    : "recreate" (delete existing series), "retain" (keep the data and replace retention and labels)
+//              or "shared" (series written by several instances: created only if it does not exist)
+// ARGV[2]    : retention in msec
+// ARGV[3]    : duplicate policy (e.g. "SUM") or "" for the server default
+// ARGV[4]    : retention of the compacted series in msec
+// ARGV[5]    : number of compaction rules m followed by m quadruplets of
+//              <aggregator> <bucket in msec> <key suffix of the compacted series> <value of the label "compaction">
+// ARGV[...]  : for each key, the number of labels n followed by n pairs of <name> <value>
+// returns the number of created series (without the compacted series)
+static constexpr std::string_view CreateTimeseries{R"(
+local mode = ARGV[1]
+local nRules = tonumber(ARGV[5])
+local rules = {}
+for r = 1, nRules do
+    local b = 5 + 4 * (r - 1)
+    rules[r] = {ARGV[b + 1], ARGV[b + 2], ARGV[b + 3], ARGV[b + 4]}
+end
+local a = 6 + 4 * nRules
+local n = 0
+for _, key in ipairs(KEYS) do
+    local nLabels = tonumber(ARGV[a])
+    local labels = {}
+    for j = 1, 2 * nLabels do
+        labels[j] = ARGV[a + j]
+    end
+    a = a + 2 * nLabels + 1
+    local exists = (redis.call('EXISTS', key) == 1)
+    if not (exists and mode == 'shared') then
+        if exists and mode == 'recreate' then
+            redis.call('DEL', key)
+            exists = false
+        end
+        if exists then
+            redis.call('TS.ALTER', key, 'RETENTION', ARGV[2], 'LABELS', unpack(labels))
+        elseif ARGV[3] ~= '' then
+            redis.call('TS.CREATE', key, 'RETENTION', ARGV[2], 'DUPLICATE_POLICY', ARGV[3], 'LABELS', unpack(labels))
+            n = n + 1
+        else
+            redis.call('TS.CREATE', key, 'RETENTION', ARGV[2], 'LABELS', unpack(labels))
+            n = n + 1
+        end
+        for _, rule in ipairs(rules) do
+            local dest = key .. rule[3]
+            local destLabels = {unpack(labels)}
+            destLabels[#destLabels + 1] = 'compaction'
+            destLabels[#destLabels + 1] = rule[4]
+            if mode == 'recreate' then
+                redis.call('DEL', dest)
+            end
+            if redis.call('EXISTS', dest) == 1 then
+                redis.call('TS.ALTER', dest, 'RETENTION', ARGV[4], 'LABELS', unpack(destLabels))
+            else
+                redis.call('TS.CREATE', dest, 'RETENTION', ARGV[4], 'LABELS', unpack(destLabels))
+            end
+            -- error reply if the rule already exists (retained series)
+            redis.pcall('TS.CREATERULE', key, dest, 'AGGREGATION', rule[1], rule[2])
+        end
+    end
+end
+return n
+)"};
+
+//_____________________________________________________________________________
+// Heartbeat of a service instance: refresh all liveness keys in one call.
+// KEYS[1]    : health hash
+// KEYS[2]    : presence
+// KEYS[3]    : fair-mq-state
+// KEYS[4]    : updated time
+// KEYS[5...7]: hash, leases and free indices of the service-instance-index (see AllocateInstanceIndex)
+// KEYS[8]    : program options hash
+// KEYS[9...] : other keys of the instance (channels, sockets) whose TTL is refreshed
+// ARGV[1]    : TTL in sec
+// ARGV[2]    : uuid (value of presence)
+// ARGV[3]    : state name
+// ARGV[4]    : updated time
+// ARGV[5]    : uptime in msec
+// ARGV[6]    : service-instance-index or "" (id given by the option)
+// returns {number of keys whose TTL is refreshed (keys already expired are not recreated), lease, options}
+// lease = 1: renewed (or no index), 2: the lease had lapsed and the index is taken back from the free list,
+//         0: the lease had lapsed and the index has been given to another instance (the id is duplicated)
+// options = 0: the program options hash does not exist (lost) and has to be written again
+static constexpr std::string_view Heartbeat{R"(
+redis.call('HSET', KEYS[1], 'updatedTime', ARGV[4], 'uptime', ARGV[5])
+redis.call('SET', KEYS[2], ARGV[2], 'EX', ARGV[1])
+redis.call('SET', KEYS[3], ARGV[3], 'EX', ARGV[1])
+redis.call('SET', KEYS[4], ARGV[4], 'EX', ARGV[1])
+local lease = 1
+if ARGV[6] ~= '' then
+    local t = redis.call('TIME')
+    local now = tonumber(t[1]) * 1000 + math.floor(tonumber(t[2]) / 1000)
+    local owner = redis.call('HGET', KEYS[5], ARGV[6])
+    if owner == ARGV[2] then
+        -- the index is ours, even if the lease has expired but not been reclaimed yet
+        redis.call('ZADD', KEYS[6], now + tonumber(ARGV[1]) * 1000, ARGV[6])
+    elseif not owner then
+        -- reclaimed to the free list by AllocateInstanceIndex but not given to another instance
+        redis.call('ZREM', KEYS[7], ARGV[6])
+        redis.call('HSET', KEYS[5], ARGV[6], ARGV[2])
+        redis.call('ZADD', KEYS[6], now + tonumber(ARGV[1]) * 1000, ARGV[6])
+        lease = 2
+    else
+        lease = 0
+    end
+end
+local options = redis.call('EXPIRE', KEYS[8], ARGV[1])
+local n = redis.call('EXPIRE', KEYS[1], ARGV[1]) + options
+for i = 9, #KEYS do
+    n = n + redis.call('EXPIRE', KEYS[i], ARGV[1])
+end
+return {n, lease, options}
+)"};
+
+//_____________________________________________________________________________
+// Allocate the lowest free service-instance-index without a lock.
+// Each allocated index has a lease (renewed by Heartbeat). Expired leases are moved to the free list,
+// so the cost does not depend on the number of running instances.
+// KEYS[1] : hash of the service-instance-index (field = index, value = uuid)
+// KEYS[2] : leases (sorted set, member = index, score = expiry in msec)
+// KEYS[3] : free indices (sorted set, member = index, score = index)
+// ARGV[1] : uuid
+// ARGV[2] : TTL in sec
+// returns the index. the presence key of the instance depends on the index and is set by the caller,
+// so that the script touches only the declared keys.
+static constexpr std::string_view AllocateInstanceIndex{R"(
+local t = redis.call('TIME')
+local now = tonumber(t[1]) * 1000 + math.floor(tonumber(t[2]) / 1000)
+local ttl = tonumber(ARGV[2])
+for _, i in ipairs(redis.call('ZRANGEBYSCORE', KEYS[2], '-inf', '(' .. now)) do
+    redis.call('ZREM', KEYS[2], i)
+    redis.call('HDEL', KEYS[1], i)
+    redis.call('ZADD', KEYS[3], tonumber(i), i)
+end
+local index
+local free = redis.call('ZPOPMIN', KEYS[3])
+if #free > 0 then
+    index = tonumber(free[1])
+else
+    -- indices [0, n) are leased or free
+    index = redis.call('ZCARD', KEYS[2])
+    while redis.call('ZSCORE', KEYS[2], tostring(index)) do
+        index = index + 1
+    end
+end
+redis.call('ZADD', KEYS[2], now + ttl * 1000, tostring(index))
+redis.call('HSET', KEYS[1], tostring(index), ARGV[1])
+return index
+)"};
+
+//_____________________________________________________________________________
+// Release the service-instance-index (on unregister). Nothing is done if the index has been given to another instance.
+// KEYS[1...3] : same as AllocateInstanceIndex
+// ARGV[1]     : index
+// ARGV[2]     : uuid
+// returns 1 if released
+static constexpr std::string_view ReleaseInstanceIndex{R"(
+if redis.call('HGET', KEYS[1], ARGV[1]) ~= ARGV[2] then
+    return 0
+end
+redis.call('HDEL', KEYS[1], ARGV[1])
+redis.call('ZREM', KEYS[2], ARGV[1])
+redis.call('ZADD', KEYS[3], tonumber(ARGV[1]), ARGV[1])
+return 1
+)"};
+
+} // namespace daq::service::lua
+
+#endif
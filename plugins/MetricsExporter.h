@@ -0,0 +1,31 @@
+#ifndef DaqService_Plugins_MetricsExporter_h
+#define DaqService_Plugins_MetricsExporter_h
+
+// Backends of the metrics plugin in addition to (or instead of) RedisTimeSeries.
+// Each sample of a time series is handed to all exporters by MetricsPlugin::AddSample()
+// and Flush() is called when the pipeline is executed. Both are called from the publisher thread.
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+namespace daq::service {
+
+// labels of a time series (same as the labels of ts.create)
+using MetricLabels = std::map<std::string, std::string>;
+
+class MetricsExporter {
+public:
+    virtual ~MetricsExporter() = default;
+
+    // key       : key of the time series (ts:<id>:...)
+    // timestamp : milliseconds since epoch
+    virtual void Add(const std::string &key, const MetricLabels &labels, int64_t timestamp, const std::string &value) = 0;
+    virtual void Flush() = 0;
+    // the time series does not exist any more (e.g. the thread has exited)
+    virtual void Remove(const std::string &/*key*/) {}
+};
+
+} // namespace daq::service
+
+#endif
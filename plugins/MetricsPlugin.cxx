@@ -1,27 +1,48 @@
+#include <dirent.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <charconv>
 #include <cmath>
-#include <fstream>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <iterator>
 #include <regex>
+#include <stdexcept>
 #include <vector>
 
 #include <boost/algorithm/string.hpp>
+#include <boost/property_tree/ptree.hpp>
 
 #include <fairmq/FairMQLogger.h>
+#include <fairmq/shmem/Common.h>
+#include <fairmq/shmem/Monitor.h>
+#include <fairmq/Tools.h>
 
 #include <sw/redis++/redis++.h>
-#include <sw/redis++/patterns/redlock.h>
 #include <sw/redis++/errors.h>
 
 #include "plugins/Constants.h"
 #include "plugins/Functions.h"
+#include "plugins/LuaScripts.h"
+#include "plugins/ProcFile.h"
 #include "plugins/TimeUtil.h"
+#include "plugins/tools.h"
 #include "plugins/MetricsPlugin.h"
+#include "plugins/PrometheusExporter.h"
+#include "plugins/RedisConnections.h"
+#include "plugins/ShmTableExporter.h"
+#ifdef WITH_OTEL_CPP
+#include "plugins/OtlpExporter.h"
+#endif
 
 static constexpr std::string_view MyClass{"daq::service::MetricsPlugin"};
+// expired instances deleted by one call of the script lua::DeleteExpiredFields (bounded execution time)
+static constexpr long long MaxExpiredPerCall{1000};
+// max wait of a control record (RunStart, RunStop) for room in the queue to the publisher thread
+static constexpr std::chrono::milliseconds ControlPushTimeout{1000};
 
 using namespace std::string_literals;
 
@@ -37,6 +58,9 @@ enum ProcSelfStat {
     // /proc/[pid]/stat
     Pid         = 0,  // the process ID
     Comm        = 1,  // The file name of the executable.
+    State       = 2,  // process state (the first field after the comm)
+    MinFlt      = 9,  // The number of minor faults the process has made which have not required loading a memory page from disk.
+    MajFlt      = 11, // The number of major faults the process has made which have required loading a memory page from disk.
     Utime       = 13, // Amount of time that this process has been scheduled in user mode, measured in clock ticks.
     // This includes guest time.
     Stime       = 14, // Amount of time that this process has been schedule in kernel mode, measured in clock ticks.
@@ -119,6 +143,45 @@ SocketMetricsKey ReplaceAll(const SocketMetricsKey& input, std::string_view sear
     ret.bytesOut = boost::replace_all_copy(input.bytesOut, search.data(), format.data());
     return ret;
 }
+
+//_____________________________________________________________________________
+// "avg:10000,max:60000" -> {avg, 10000, avg-10s}, {max, 60000, max-1m}
+std::vector<CompactionRule> ParseCompactionRules(const std::string &s)
+{
+    std::vector<CompactionRule> ret;
+    std::vector<std::string> items;
+    boost::split(items, s, boost::is_any_of(","));
+    for (auto item : items) {
+        boost::trim(item);
+        if (item.empty()) {
+            continue;
+        }
+        const auto p = item.find(':');
+        if (p == std::string::npos) {
+            throw std::invalid_argument("compaction rule must be <aggregator>:<bucket in msec> : " + item);
+        }
+        CompactionRule r;
+        r.aggregator = boost::to_lower_copy(item.substr(0, p));
+        const auto bucket = std::stoll(item.substr(p + 1));
+        if (bucket <= 0) {
+            throw std::invalid_argument("bucket of compaction rule must be positive : " + item);
+        }
+        r.bucket = std::to_string(bucket);
+        std::string unit;
+        if (bucket % 3600000 == 0) {
+            unit = std::to_string(bucket / 3600000) + "h";
+        } else if (bucket % 60000 == 0) {
+            unit = std::to_string(bucket / 60000) + "m";
+        } else if (bucket % 1000 == 0) {
+            unit = std::to_string(bucket / 1000) + "s";
+        } else {
+            unit = r.bucket + "ms";
+        }
+        r.name = r.aggregator + "-" + unit;
+        ret.push_back(std::move(r));
+    }
+    return ret;
+}
 } // namespace daq::service
 
 //_____________________________________________________________________________
@@ -130,11 +193,65 @@ auto daq::service::MetricsPluginProgramOptions() -> fair::mq::Plugin::ProgOption
 
     auto options = bpo::options_description(MyClass.data());
     options.add_options()
-    (opt::UpdateInterval.data(), bpo::value<long long>()->default_value(1000),     "update interval in milliseconds for CPU and memory usage.")
+    (opt::UpdateInterval.data(), bpo::value<long long>()->default_value(1000),     "update interval in milliseconds for CPU and memory usage. (if zero or negative, process metrics are not sent.)")
     (opt::ServerUri.data(),      bpo::value<std::string>(),                        "Redis server URI (if empty, the same URI of the service registry is used.)")
-    (opt::Retention.data(),      bpo::value<std::string>()->default_value("0"),    "Retention time in msec for time series data. When set to 0, the series is not trimmed at all.")
-    (opt::RecreateTS.data(),     bpo::value<std::string>()->default_value("true"), "Recreate timeseries data on state transition to Running")
-    (opt::MaxTtl.data(),         bpo::value<std::string>()->default_value("3000"), "Max TTL for metrics in milliseconds. (if zero or negative, no TTL is set.)");
+    (opt::Retention.data(),      bpo::value<std::string>()->default_value("604800000"), "Retention time in msec for time series data. When set to 0, the series is not trimmed at all.")
+    (opt::RecreateTS.data(),     bpo::value<std::string>()->default_value("false"),
+     "Recreate timeseries data on state transition to Running.\n"
+     "If false, the series are retained across runs (trimmed by the retention) and the label run_number is updated on Running.")
+    (opt::MaxTtl.data(),         bpo::value<std::string>()->default_value("3000"), "Max TTL for metrics in milliseconds. (if zero or negative, no TTL is set.)")
+    (opt::MigrateIndex.data(),   bpo::value<std::string>()->default_value("false"),
+     "One-time migration after an upgrade (set on one device): add the instances of the previous versions (hash last-update-ns)\n"
+     "and the field indices without an entry in last-update-index to last-update-index, so that their fields are deleted when expired.")
+    (opt::SocketMetricsMode.data(), bpo::value<std::string>()->default_value("log"),
+     "Source of socket metrics.\n"
+     " log    : parse the rate log lines of FairMQ (resolution is given by rateLogging of the channel)\n"
+     " sample : read message and byte counters of the channel sockets.\n"
+     "          The device must register \"GetSocketCounters()\" (see plugins/SocketCounters.h).")
+    (opt::SocketSampleInterval.data(), bpo::value<long long>()->default_value(1000), "Sampling interval in milliseconds for socket metrics (socket-metrics-mode=sample).")
+    (opt::QueueSize.data(),      bpo::value<std::size_t>()->default_value(8192),   "Capacity of the queue to the metrics publisher thread. When the queue is full, metrics are dropped and counted.")
+    (opt::TsMadd.data(),         bpo::value<std::string>()->default_value("true"), "Write samples of time series with one TS.MADD per flush. (if false, one TS.ADD per sample)")
+    (opt::CompatKeys.data(),     bpo::value<std::string>()->default_value("false"),
+     "Write socket metrics also to the legacy hashes (metrics:msg-in, metrics:num-msg, ...) in addition to the per-device hash (metrics:socket:<id>).")
+    (opt::FlushMaxCommands.data(), bpo::value<std::size_t>()->default_value(1024), "Execute the pipeline when the number of queued redis commands reaches this value. (with ts-madd=true, all samples of a flush are one command)")
+    (opt::FlushMaxAge.data(),    bpo::value<long long>()->default_value(1000),     "Execute the pipeline when the oldest queued command is older than this value in milliseconds. (if zero or negative, no limit)")
+    (opt::ThreadMetrics.data(),  bpo::value<std::string>()->default_value("false"),
+     "Write time series of each thread (cpu usage, context switches and run-queue delay) from /proc/self/task/<tid>/{stat,status,schedstat}.")
+    (opt::IoMetrics.data(),      bpo::value<std::string>()->default_value("true"),
+     "Write time series of the network interface of the device (network-interface) from /proc/net/dev and /sys/class/net/<nic>/speed,\n"
+     "storage I/O of the process (read_bytes, write_bytes of /proc/self/io) and page faults.")
+    (opt::Exporter.data(),       bpo::value<std::string>()->default_value("redis"),
+     "Comma separated list of backends for time series data.\n"
+     " redis      : RedisTimeSeries (ts.create, ts.madd)\n"
+     " prometheus : Prometheus text format on http://<host>:<prometheus-port>/metrics\n"
+     " otlp       : OTLP/HTTP to otlp-endpoint (requires build with WITH_OTEL_CPP)\n"
+     " shm        : shared memory table (/dev/shm/nestdaq-metrics.<id>) read by daq-metrics-aggregator\n"
+     "Hashes for the registry (state, cpu-stat, last-update, ...) are always written to Redis, also with shm only:\n"
+     "the aggregator writes only time series, and the hashes are the latest values of each device and\n"
+     "the liveness index (last-update-index) used to delete the fields of expired instances.\n"
+     "They are sent in the same pipeline as the other commands (one round trip per flush).")
+    (opt::PrometheusPort.data(), bpo::value<unsigned short>()->default_value(0),
+     "TCP port of the Prometheus endpoint on host-ip. (0 = a free port chosen by the kernel)\n"
+     "The bound port is written to the hash metrics:prometheus-port (field = id) for service discovery.")
+    (opt::OtlpEndpoint.data(),   bpo::value<std::string>()->default_value("http://localhost:4318/v1/metrics"), "URL of the OTLP/HTTP metrics receiver.")
+    (opt::OtlpExportInterval.data(), bpo::value<long long>()->default_value(10000), "Export interval in milliseconds for OTLP.")
+    (opt::ShmTableSize.data(),   bpo::value<unsigned int>()->default_value(4096),  "Max number of time series in the shared memory table (metrics-exporter=shm).")
+    (opt::CustomInterval.data(), bpo::value<long long>()->default_value(1000),     "Publish interval in milliseconds for custom metrics of the device (see plugins/CustomMetrics.h). (if zero or negative, not published.)")
+    (opt::SpoolDir.data(),       bpo::value<std::string>()->default_value(""),
+     "Directory of the spool for time series samples while the Redis server is unreachable. The samples are sent after the recovery. (if empty, the samples are dropped.)")
+    (opt::SpoolSegmentSize.data(), bpo::value<std::size_t>()->default_value(16),  "Size of a spool segment file in MiB.")
+    (opt::SpoolMaxSize.data(),   bpo::value<std::size_t>()->default_value(256),    "Max total size of the spool in MiB. When exceeded, the oldest segment is dropped.")
+    (opt::SpoolRetryInterval.data(), bpo::value<long long>()->default_value(1000), "Interval in milliseconds to check the recovery of the Redis server.")
+    (opt::SpoolReplayBatch.data(), bpo::value<std::size_t>()->default_value(1000), "Number of samples sent with one ts.madd on replay.")
+    (opt::Compaction.data(),     bpo::value<std::string>()->default_value(""),
+     "Comma separated list of compaction rules <aggregator>:<bucket in msec> created for each time series (ts.createrule), e.g. avg:10000,avg:60000.\n"
+     "The compacted series is <key>:<aggregator>-<bucket> (e.g. ts:<id>:cpu-stat:avg-10s) with the label compaction=<aggregator>-<bucket>.\n"
+     "Each rule adds one series for every series (including the per-thread and histogram series). (if empty, no compaction)")
+    (opt::CompactionRetention.data(), bpo::value<std::string>()->default_value("2592000000"), "Retention of the compacted series in milliseconds.")
+    (opt::ServiceAggregate.data(), bpo::value<std::string>()->default_value("false"),
+     "Write the sum across the instances of the service: ts:service:<service>:<channel>:{msg-in,mb-in,msg-out,mb-out} and ts:service:<service>:{cpu-stat,ram-stat}.")
+    (opt::ServiceAggregateBucket.data(), bpo::value<long long>()->default_value(1000),
+     "Bucket in milliseconds of the per-service sums. Each instance adds the mean of its samples in the bucket, and the values of all instances are summed up, so this should be equal to the sampling interval (rateLogging, socket-sample-interval, proc-stat-update-interval).");
     return options;
 }
 
@@ -165,6 +282,32 @@ daq::service::MetricsPlugin::MetricsPlugin(std::string_view name,
 
     fRetentionMS = GetProperty<std::string>(opt::Retention.data());
     fMaxTtl      = std::stoll(GetProperty<std::string>(opt::MaxTtl.data()));
+    fUpdateInterval = GetProperty<long long>(opt::UpdateInterval.data());
+    fCustomInterval = GetProperty<long long>(opt::CustomInterval.data());
+    {
+        auto f = GetProperty<std::string>(opt::TsMadd.data());
+        boost::to_lower(f);
+        fTsMadd = (f=="true") || (f=="1");
+        f = GetProperty<std::string>(opt::CompatKeys.data());
+        boost::to_lower(f);
+        fCompatKeys = (f=="true") || (f=="1");
+        f = GetProperty<std::string>(opt::ThreadMetrics.data());
+        boost::to_lower(f);
+        fThreadMetrics = (f=="true") || (f=="1");
+        f = GetProperty<std::string>(opt::IoMetrics.data());
+        boost::to_lower(f);
+        fIoMetrics = (f=="true") || (f=="1");
+    }
+    fCompactionRules       = ParseCompactionRules(GetProperty<std::string>(opt::Compaction.data()));
+    fCompactionRetentionMS = GetProperty<std::string>(opt::CompactionRetention.data());
+    {
+        auto f = GetProperty<std::string>(opt::ServiceAggregate.data());
+        boost::to_lower(f);
+        fServiceAggregate = (f=="true") || (f=="1");
+        fServiceAggregateBucket = std::max(1LL, GetProperty<long long>(opt::ServiceAggregateBucket.data()));
+    }
+    fFlushMaxCommands = GetProperty<std::size_t>(opt::FlushMaxCommands.data());
+    fFlushMaxAge      = GetProperty<long long>(opt::FlushMaxAge.data());
 
     if (PropertyExists("created-time")) {
         auto t = GetProperty<int64_t>("created-time");
@@ -178,9 +321,17 @@ daq::service::MetricsPlugin::MetricsPlugin(std::string_view name,
     fStateKey        = join({fTopPrefix, StatePrefix.data()},        fSeparator);
     fLastUpdateKey   = join({fTopPrefix, LastUpdatePrefix.data()},   fSeparator);
     fLastUpdateNSKey = join({fTopPrefix, LastUpdateNSPrefix.data()}, fSeparator);
+    fDroppedKey      = join({fTopPrefix, DroppedPrefix.data()},      fSeparator);
+    fSocketKey       = join({fTopPrefix, SocketPrefix.data(), fId},  fSeparator);
+    fQueuedCommandsKey = join({fTopPrefix, QueuedCommandsPrefix.data()}, fSeparator);
+    fFlushLatencyKey   = join({fTopPrefix, FlushLatencyPrefix.data()},   fSeparator);
+    fPrometheusPortKey = join({fTopPrefix, PrometheusPortPrefix.data()}, fSeparator);
     fProcKey.stateId = join({fTopPrefix, StateIdPrefix.data()},      fSeparator);
     fProcKey.cpu     = join({fTopPrefix, CpuStatPrefix.data()},      fSeparator);
     fProcKey.ram     = join({fTopPrefix, RamStatPrefix.data()},      fSeparator);
+    fShmKey.used     = join({fTopPrefix, ShmUsedPrefix.data()},      fSeparator);
+    fShmKey.free     = join({fTopPrefix, ShmFreePrefix.data()},      fSeparator);
+    fShmKey.regions  = join({fTopPrefix, ShmRegionsPrefix.data()},   fSeparator);
 
     fSockKey.msgIn    = join({fTopPrefix, MessageInPrefix.data()},  fSeparator);
     fSockKey.bytesIn  = join({fTopPrefix, BytesInPrefix.data()},    fSeparator);
@@ -196,6 +347,9 @@ daq::service::MetricsPlugin::MetricsPlugin(std::string_view name,
 
     auto t     = ReplaceAll(fProcKey, std::string(fTopPrefix)+fSeparator.data(), "");
     fTsProcKey = Prepend(t, join({"ts", fId}, fSeparator), fSeparator);
+    fTsShmKey.used    = join({"ts", fId, ShmUsedPrefix.data()},    fSeparator);
+    fTsShmKey.free    = join({"ts", fId, ShmFreePrefix.data()},    fSeparator);
+    fTsShmKey.regions = join({"ts", fId, ShmRegionsPrefix.data()}, fSeparator);
 
     /*
     LOG(debug) << " StateKey       = " << fStateKey
@@ -233,7 +387,8 @@ daq::service::MetricsPlugin::MetricsPlugin(std::string_view name,
         serverUri = GetProperty<std::string>(ServiceRegistryUri.data());
     }
     if (!serverUri.empty()) {
-        fClient = std::make_shared<sw::redis::Redis>(serverUri);
+        fConnections = GetRedisConnections(*this, serverUri);
+        fClient      = fConnections->GetClient();
     }
 
     const auto fCreatedTimeKey = join({fTopPrefix, CreatedTimePrefix.data()},   fSeparator);
@@ -249,39 +404,65 @@ daq::service::MetricsPlugin::MetricsPlugin(std::string_view name,
     fStopTimeKey    = join({fTopPrefix, StopTime.data()}, fSeparator);
     fStopTimeNSKey  = join({fTopPrefix, StopTimeNS.data()}, fSeparator);
     fRunNumberKey   = join({fTopPrefix, RunNumber.data()}, fSeparator);
+    fRunSummaryKey  = join({fTopPrefix, RunSummaryPrefix.data()}, fSeparator);
+    if (PropertyExists(RunNumber.data())) {
+        fRunNumber = GetProperty<std::string>(RunNumber.data());
+    }
 
-    fRegisteredKeys.insert({fStateKey, fLastUpdateKey, fLastUpdateNSKey,
+    fRegisteredKeys.insert({fStateKey, fLastUpdateKey, fLastUpdateNSKey, fDroppedKey,
+                            fQueuedCommandsKey, fFlushLatencyKey, fPrometheusPortKey,
                             fStartTimeKey, fStartTimeNSKey, fStopTimeKey, fStopTimeNSKey,
                             fRunNumberKey,
                             fProcKey.stateId, fProcKey.cpu, fProcKey.ram,
+                            fShmKey.used, fShmKey.free, fShmKey.regions,
                             fCreatedTimeKey, fHostNameKey, fIpAddressKey});
     //for (auto k : fRegisteredKeys) {
     //  LOG(debug) << " key = " << k;
     //}
-    fRegisteredSockKeys.insert({fSockKey.msgIn, fSockKey.bytesIn, fSockKey.msgOut, fSockKey.bytesOut,
-                                fSockSumKey.msgIn, fSockSumKey.bytesIn, fSockSumKey.msgOut, fSockSumKey.bytesOut,
-                                fNumMessageKey, fBytesKey, fNumMessageSumKey, fBytesSumKey});
+    fLastUpdateIndexKey = join({fTopPrefix, LastUpdateIndexPrefix.data()}, fSeparator);
+    fFieldIndexKey      = join({fTopPrefix, FieldIndexPrefix.data(), fId}, fSeparator);
 
     fPipe = std::make_unique<sw::redis::Pipeline>(std::move(fClient->pipeline()));
     if (fMaxTtl>0) {
+        auto f = GetProperty<std::string>(opt::MigrateIndex.data());
+        boost::to_lower(f);
+        if ((f=="true") || (f=="1")) {
+            MigrateFieldIndex();
+        }
         DeleteExpiredFields();
     }
 
+    StartExporters();
     {
         //const auto &[uptimeNSec, lastUpdate] = update_date(fCreatedTimeSystem, fCreatedTime);
         //auto lastUpdateNS = std::chrono::duration_cast<std::chrono::nanoseconds>(lastUpdate.time_since_epoch());
         std::lock_guard<std::mutex> lock{fMutex};
+        if (fPrometheusPort>0) {
+            fPipe->hset(fPrometheusPortKey, fId, std::to_string(fPrometheusPort));
+        }
         fPipe->hset(fCreatedTimeKey, fId, to_date(fCreatedTimeSystem))
         .hset(fHostNameKey,    fId, GetProperty<std::string>("hostname"))
         .hset(fIpAddressKey,   fId, GetProperty<std::string>("host-ip"))
+        // an instance without an entry in the sorted set is regarded as expired by DeleteExpiredFields()
+        .zadd(fLastUpdateIndexKey, fId, static_cast<double>(to_msec(std::chrono::system_clock::now())))
         //.hset(fLastUpdateKey, fId, to_date(lastUpdate))
         //.hset(fLastUpdateNSKey, fId, std::to_string(lastUpdateNS.count()))
         .exec();
     }
-    fair::Logger::AddCustomSink(MyClass.data(), "info", [this](const std::string &content, const fair::LogMetaData &metadata) {
-        std::lock_guard<std::mutex> lock{fMutex};
-        SendSocketMetrics(content);
-    });
+    StartSpool();
+    StartPublisher();
+    {
+        auto mode = GetProperty<std::string>(opt::SocketMetricsMode.data());
+        boost::to_lower(mode);
+        fSampleSockets        = (mode=="sample");
+        fSocketSampleInterval = GetProperty<long long>(opt::SocketSampleInterval.data());
+    }
+    StartSamplers();
+    if (!fSampleSockets) {
+        fair::Logger::AddCustomSink(MyClass.data(), "info", [this](const std::string &content, const fair::LogMetaData &metadata) {
+            ParseSocketMetrics(content, static_cast<int64_t>(metadata.timestamp) * 1000 + metadata.us.count() / 1000);
+        });
+    }
 
     SubscribeToPropertyChangeAsString([this](const std::string& key, std::string value) {
         if (
@@ -291,50 +472,100 @@ daq::service::MetricsPlugin::MetricsPlugin(std::string_view name,
             (key==StopTimeNS)  ||
             (key==RunNumber)) {
             //LOG(debug) << MyClass << " (subscribed callback) key = " << key << ", value = " << value;
-            std::lock_guard<std::mutex> lock{fMutex};
-            fClient->hset(join({fTopPrefix, key}, fSeparator), fId, value);
-
+            if ((key==RunNumber) && (value!=fRunNumber)) {
+                std::lock_guard<std::mutex> lock{fMutex};
+                fRunNumber = value;
+                if (fRunning && !IsRecreateTS()) {
+                    UpdateRunLabels();
+                }
+            }
+            MetricRecord r;
+            r.type  = MetricRecord::Type::Hash;
+            r.key   = join({fTopPrefix, key}, fSeparator);
+            r.field = fId;
+            r.value = value;
+            Push(std::move(r));
+            Push(MetricRecord{}); // flush
         }
     });
 
     SubscribeToDeviceStateChange([this](DeviceState newState) {
-        auto pipelineUsed{false};
         const auto stateName = GetStateName(newState);
         LOG(debug) << MyClass << " state change: " << stateName;
         {
-            std::lock_guard<std::mutex> lock{fMutex};
-            if (fPipe) {
-                fPipe->discard();
-                fPipe->hset(fStateKey,        fId, stateName)
-                .hset(fProcKey.stateId, {std::make_pair(fId, static_cast<int>(newState))})
-                .exec();
-                pipelineUsed = true;
+            MetricRecord r;
+            r.type  = MetricRecord::Type::Hash;
+            r.key   = fStateKey;
+            r.field = fId;
+            r.value = stateName;
+            Push(std::move(r));
+            r.type  = MetricRecord::Type::Hash;
+            r.key   = fProcKey.stateId;
+            r.field = fId;
+            r.value = std::to_string(static_cast<int>(newState));
+            Push(std::move(r));
+            Push(MetricRecord{}); // flush
+        }
+        if (fSampleSockets) {
+            std::lock_guard<std::mutex> lock{fSampleMutex};
+            fGetSocketCounters = nullptr;
+            fSocketCountersStart.clear();
+            fSocketCountersLast.clear();
+            // channel sockets are read only in Running state
+            if ((newState==DeviceState::Running) && PropertyExists(GetSocketCountersFunction.data())) {
+                fGetSocketCounters = GetProperty<SocketCountersFunction_t>(GetSocketCountersFunction.data());
             }
         }
         switch (newState) {
         case DeviceState::DeviceReady:
             InitializeSocketProperties();
+            InitializeShmMetrics();
             break;
         case DeviceState::Ready:
         {
-            if (IsRecreateTS()) {
-                DeleteTSKeys();
+            {
+                std::lock_guard<std::mutex> lock{fMutex};
+                fChannelHistograms.reset();
+                fChannelQueues.reset();
+                fCustomMetrics.reset();
             }
-            fSocketMetrics.clear();
-            fNumChannels.clear();
+            // redis I/O (run summary, deletion of the series) is done by the publisher thread
+            MetricRecord r;
+            r.type = MetricRecord::Type::RunStop;
+            PushControl(std::move(r));
             break;
         }
         case DeviceState::Running:
-            if (IsRecreateTS()) {
-                pipelineUsed |= CreateTimeseries(fTsProcKey.cpu,     {{DataType.data(), CpuStatPrefix.data()}});
-                pipelineUsed |= CreateTimeseries(fTsProcKey.ram,     {{DataType.data(), RamStatPrefix.data()}});
-                pipelineUsed |= CreateTimeseries(fTsProcKey.stateId, {{DataType.data(), StateIdPrefix.data()}});
-                pipelineUsed |= CreateSocketTS();
-                if (pipelineUsed) {
-                    fPipe->exec();
+        {
+            if (PropertyExists(GetChannelHistogramsFunction.data())) {
+                std::lock_guard<std::mutex> lock{fMutex};
+                fChannelHistograms = GetProperty<ChannelHistogramsFunction_t>(GetChannelHistogramsFunction.data())();
+            }
+            if (PropertyExists(GetCustomMetricsFunction.data())) {
+                std::lock_guard<std::mutex> lock{fMutex};
+                fCustomMetrics    = GetProperty<CustomMetricsFunction_t>(GetCustomMetricsFunction.data())();
+                fCustomSampleTime = std::chrono::steady_clock::now();
+                fCustomCounterLast.clear();
+            }
+            if (PropertyExists(GetChannelQueuesFunction.data())) {
+                std::lock_guard<std::mutex> lock{fMutex};
+                fChannelQueues   = GetProperty<ChannelQueuesFunction_t>(GetChannelQueuesFunction.data())();
+                fQueueSampleTime = std::chrono::steady_clock::now();
+            }
+            {
+                std::lock_guard<std::mutex> lock{fMutex};
+                fRunStartTime     = std::chrono::system_clock::now();
+                fRunStartCpuTicks = ReadProcSelfStat().sum();
+                if (PropertyExists(RunNumber.data())) {
+                    fRunNumber = GetProperty<std::string>(RunNumber.data());
                 }
             }
+            // creation and label update of the series are done by the publisher thread
+            MetricRecord r;
+            r.type = MetricRecord::Type::RunStart;
+            PushControl(std::move(r));
             break;
+        }
         default:
             break;
         }
@@ -348,19 +579,159 @@ daq::service::MetricsPlugin::~MetricsPlugin()
 
     UnsubscribeFromDeviceStateChange();
     UnsubscribeFromPropertyChangeAsString();
-    fair::Logger::RemoveCustomSink(MyClass.data());
+    if (!fSampleSockets) {
+        fair::Logger::RemoveCustomSink(MyClass.data());
+    }
     LOG(debug) << MyClass << "UnsubscribeFromDeviceStateChange()";
-    //fContext->stop();
-    //if (fTimerThread.joinable()) {
-    //  fTimerThread.join();
-    //  LOG(debug) << MyClass << " timer thread joined.";
-    //}
+    if (fContext) {
+        fContext->stop();
+    }
+    if (fTimerThread.joinable()) {
+        fTimerThread.join();
+        LOG(debug) << MyClass << " timer thread joined.";
+    }
+    fPublisherStopRequested = true;
+    fPublisherCondition.notify_one();
+    if (fPublisherThread.joinable()) {
+        fPublisherThread.join();
+        LOG(debug) << MyClass << " publisher thread joined.";
+    }
+    if (fQueue) {
+        // records pushed after the last round of the publisher thread (e.g. the final state)
+        {
+            std::lock_guard<std::mutex> lock{fMutex};
+            MetricRecord r;
+            auto n{0};
+            while (fQueue->TryPop(r)) {
+                Publish(r);
+                ++n;
+            }
+            if (n>0) {
+                r = MetricRecord{};
+                Publish(r);
+            }
+            LOG(debug) << MyClass << " n records drained = " << n;
+        }
+        SendFlush();
+    }
+    fSpoolStopRequested = true;
+    fSpoolCondition.notify_one();
+    if (fSpoolThread.joinable()) {
+        fSpoolThread.join();
+        LOG(debug) << MyClass << " spool thread joined.";
+    }
+    fSpool.reset();
+    fExporters.clear();
     if (fPipe) {
         fPipe.reset();
     }
     LOG(debug) << "~" << MyClass << "() bye";
 }
 
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::AddSample(const std::string &key, int64_t timestamp, const std::string &value)
+{
+    if (!fExporters.empty()) {
+        static const MetricLabels noLabels;
+        auto itr = fSeriesLabels.find(key);
+        const auto &labels = (itr != fSeriesLabels.end()) ? itr->second : noLabels;
+        for (auto &e : fExporters) {
+            e->Add(key, labels, timestamp, value);
+        }
+    }
+    if (!fTsRedis) {
+        return;
+    }
+    // ts.madd: one command per flush, otherwise one ts.add per sample
+    if (!fTsMadd || fTsSamples.empty()) {
+        Queued();
+    }
+    if (fTsSamples.empty()) {
+        fTsSamples.emplace_back("ts.madd");
+    }
+    fTsSamples.push_back(key);
+    fTsSamples.push_back(std::to_string(timestamp));
+    fTsSamples.push_back(value);
+}
+
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::AddServiceSample(const std::string &name,
+        std::string_view metric,
+        int64_t timestamp,
+        double value)
+{
+    if (!fServiceAggregate || !fTsRedis) {
+        return;
+    }
+    auto &series = fTsServiceKey[name + "\t" + metric.data()];
+    auto &key = series.key;
+    if (key.empty()) {
+        key = name.empty() ? join({"ts", ServiceAggregatePrefix.data(), fServiceName, metric.data()}, fSeparator)
+                           : join({"ts", ServiceAggregatePrefix.data(), fServiceName, name, metric.data()}, fSeparator);
+        if (fRegisteredServiceKeys.insert(key).second) {
+            // no id and run_number: the series is shared by all instances (and runs)
+            auto &labels = fSeriesLabels[key];
+            labels = {{DataType.data(), metric.data()}, {"service", fServiceName}, {Aggregate.data(), "sum"}};
+            if (!name.empty()) {
+                labels.emplace(SocketName.data(), name);
+            }
+            if (fPendingServiceKeys.empty()) {
+                Queued(); // one script per flush
+            }
+            fPendingServiceKeys.push_back(key);
+        }
+    }
+    // the sampling phase jitters across the bucket boundaries: two samples may fall into one bucket and none
+    // into the next. the samples of a bucket are averaged and the value is sent when the next bucket starts,
+    // a bucket skipped by the jitter gets the same value, so that each instance adds one value per bucket.
+    const auto bucket = timestamp - timestamp % fServiceAggregateBucket;
+    if (bucket == series.bucket) {
+        series.sum += value;
+        ++series.n;
+        return;
+    }
+    if ((series.n > 0) && (bucket > series.bucket)) {
+        const auto mean = std::to_string(series.sum / series.n);
+        // duplicate policy of the series is SUM
+        if (!fTsMadd || fTsSamples.empty()) {
+            Queued();
+        }
+        if (fTsSamples.empty()) {
+            fTsSamples.emplace_back("ts.madd");
+        }
+        fTsSamples.push_back(key);
+        fTsSamples.push_back(std::to_string(series.bucket));
+        fTsSamples.push_back(mean);
+        if (bucket - series.bucket == 2 * fServiceAggregateBucket) {
+            if (!fTsMadd) {
+                Queued();
+            }
+            fTsSamples.push_back(key);
+            fTsSamples.push_back(std::to_string(series.bucket + fServiceAggregateBucket));
+            fTsSamples.push_back(mean);
+        }
+    }
+    series.bucket = bucket;
+    series.sum    = value;
+    series.n      = 1;
+}
+
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::BeginRun()
+{
+    fRunning = true;
+    fRunSummary.clear();
+    if (!IsRecreateTS()) {
+        // series of the previous runs (including the ones created on first use)
+        UpdateRunLabels();
+    }
+    // with recreate-ts=false, only the series which are not registered yet are created.
+    // the process and shm series are created by the samplers, independently of the run.
+    if (CreateSocketTS()) {
+        Exec();
+    }
+}
+
 //_____________________________________________________________________________
 bool daq::service::MetricsPlugin::CreateSocketTS(std::string_view keyMsg,
         std::string_view keyBytes,
@@ -440,107 +811,393 @@ bool daq::service::MetricsPlugin::CreateTimeseries(std::string_view key,
         const std::unordered_map<std::string, std::string> &labels)
 {
     //LOG(warn) << __func__ << ":" << __LINE__;
-    if (fClient->exists(key.data())>0) {
-        //LOG(warn) << " TS key = " << key << " already exists in DB";
-        fClient->del(key.data());
-        fRegisteredTSKeys.erase(key.data());
+    auto &seriesLabels = fSeriesLabels[key.data()];
+    seriesLabels = MetricLabels(labels.cbegin(), labels.cend());
+    seriesLabels.emplace("service", fServiceName);
+    seriesLabels.emplace("id", fId);
+    if (!fRunNumber.empty()) {
+        seriesLabels[RunNumber.data()] = fRunNumber;
     }
-    std::vector<std::string> cmd;
-    cmd.push_back("ts.create");
-    cmd.push_back(key.data());
-    cmd.push_back("retention");
-    cmd.push_back(fRetentionMS);
-    cmd.push_back("labels");
-    cmd.push_back("service");
-    cmd.push_back(fServiceName);
-    cmd.push_back("id");
-    cmd.push_back(fId);
-    for (const auto& [k, v] : labels) {
-        cmd.push_back(k);
-        cmd.push_back(v);
-    }
-
-    //std::string s{" create time series data:\n"};
-    //for (const auto& x : cmd) {
-    //  s += " " + x + "\n";
-    //}
-    //LOG(debug) << s;
-
-    fPipe->command(cmd.cbegin(), cmd.cend());
+    if (!fTsRedis) {
+        fRegisteredTSKeys.emplace(key.data());
+        return false;
+    }
+    if (!IsRecreateTS() && (fRegisteredTSKeys.count(key.data())>0)) {
+        // the labels are updated by UpdateRunLabels()
+        return false;
+    }
+    // existence check, deletion (recreate-ts=true) or label update of a series of a previous process
+    // (recreate-ts=false) are done by the script in ExecCreateTimeseries() without extra round trips
+    if (fPendingTSKeys.empty()) {
+        Queued(); // one script per flush
+    }
+    fPendingTSKeys.emplace_back(key.data());
     fRegisteredTSKeys.emplace(key.data());
     return true;
 }
 
 //_____________________________________________________________________________
-void daq::service::MetricsPlugin::DeleteExpiredFields()
+void daq::service::MetricsPlugin::CreatePendingTimeseries()
 {
-    while (true) {
-        try {
-            sw::redis::RedMutex mtx(fClient, "metrics");
-            std::unique_lock<sw::redis::RedMutex> redLock(mtx, std::defer_lock);
-            if (redLock.try_lock()) {
-                LOG(debug) << "got lock: " << MyClass << " " << fId;
-
-                std::unordered_map<std::string, std::string> hashInstanceToLastUpdateNS;
-                fClient->hgetall(fLastUpdateNSKey, std::inserter(hashInstanceToLastUpdateNS, hashInstanceToLastUpdateNS.begin()));
-                std::vector<std::string> expiredInstances;
-                for (const auto& [k, v] : hashInstanceToLastUpdateNS) {
-                    auto tNS = std::stoull(v); // nanoseconds -> milliseconds
-                    auto tNow = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
-                    if ((tNow - tNS)/1e6 > fMaxTtl) {
-                        expiredInstances.push_back(k);
-                    }
-                }
+    // called by the spool thread before the replay: ts.madd rejects the samples of a series which does not exist.
+    // the keys and arguments are taken under the lock, the script runs without it.
+    std::vector<std::string> tsKeys;
+    std::vector<std::string> serviceKeys;
+    std::vector<std::string> tsArgs;
+    std::vector<std::string> serviceArgs;
+    {
+        std::lock_guard<std::mutex> lock{fMutex};
+        tsKeys.swap(fPendingTSKeys);
+        serviceKeys.swap(fPendingServiceKeys);
+        if (!tsKeys.empty()) {
+            tsArgs = CreateTimeseriesArgs(tsKeys, IsRecreateTS() ? "recreate" : "retain", "");
+        }
+        if (!serviceKeys.empty()) {
+            serviceArgs = CreateTimeseriesArgs(serviceKeys, "shared", "SUM");
+        }
+    }
+    try {
+        if (!tsKeys.empty()) {
+            fClient->eval<long long>(lua::CreateTimeseries.data(), tsKeys.cbegin(), tsKeys.cend(), tsArgs.cbegin(), tsArgs.cend());
+        }
+        if (!serviceKeys.empty()) {
+            fClient->eval<long long>(lua::CreateTimeseries.data(), serviceKeys.cbegin(), serviceKeys.cend(), serviceArgs.cbegin(), serviceArgs.cend());
+        }
+        LOG(debug) << MyClass << " " << __FUNCTION__ << " n keys = " << tsKeys.size() + serviceKeys.size();
+    } catch (const sw::redis::ReplyError &e) {
+        // the server is alive. same as an error reply of the pipeline in SendFlush()
+        LOG(error) << MyClass << " " << __FUNCTION__ << " error reply : " << e.what();
+    } catch (const sw::redis::Error &) {
+        // created at the next recovery
+        std::lock_guard<std::mutex> lock{fMutex};
+        fPendingTSKeys.insert(fPendingTSKeys.end(), tsKeys.cbegin(), tsKeys.cend());
+        fPendingServiceKeys.insert(fPendingServiceKeys.end(), serviceKeys.cbegin(), serviceKeys.cend());
+        throw;
+    }
+}
 
-                if (!expiredInstances.empty()) {
-                    for (const auto &k : fRegisteredKeys) {
-                        LOG(debug) << __func__ << ":" << __LINE__ << " delete " << k;
-                        fPipe->hdel(k, expiredInstances.begin(), expiredInstances.end());
-                    }
+//_____________________________________________________________________________
+std::vector<std::string> daq::service::MetricsPlugin::CreateTimeseriesArgs(const std::vector<std::string> &keys,
+        std::string_view mode,
+        std::string_view duplicatePolicy)
+{
+    // ARGV of the script lua::CreateTimeseries
+    std::vector<std::string> args{mode.data(), fRetentionMS, duplicatePolicy.data(), fCompactionRetentionMS,
+                                  std::to_string(fCompactionRules.size())};
+    for (const auto &r : fCompactionRules) {
+        args.push_back(r.aggregator);
+        args.push_back(r.bucket);
+        args.push_back(fSeparator + r.name);
+        args.push_back(r.name);
+    }
+    for (const auto &key : keys) {
+        const auto &labels = fSeriesLabels[key];
+        args.push_back(std::to_string(labels.size()));
+        for (const auto &[k, v] : labels) {
+            args.push_back(k);
+            args.push_back(v);
+        }
+    }
+    return args;
+}
 
-                    std::unordered_map<std::string, std::string> sockets;
-                    for (const auto &k : fRegisteredSockKeys) {
-                        fClient->hgetall(k, std::inserter(sockets, sockets.begin()));
-                        std::vector<std::string> a;
-                        for (const auto &instName : expiredInstances) {
-                            for (const auto &[sockName, v] : sockets) {
-                                if (sockName.find(instName) == 0) {
-                                    LOG(debug) << __func__ << ":" << __LINE__ << " delete " << k << " " << sockName;
-                                    fPipe->hdel(k, sockName);
-                                }
-                            }
-                        }
-                    }
-                }
-                fPipe->exec();
-                if (redLock.owns_lock()) {
-                    LOG(debug) << "unlock: " << MyClass << " " << fId;
-                    break;
-                } else {
-                    std::this_thread::yield();
-                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                }
-            }
-        } catch (const sw::redis::Error& e) {
-            LOG(error) << " caught exception (redis++) : " << e.what();
-        } catch (const std::exception& e) {
-            LOG(error) << " caught exception (std) : " << e.what();
-        } catch (...) {
-            LOG(error) << " caught exception : unknown";
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::UpdateRunLabels()
+{
+    if (!fTsRedis || fRegisteredTSKeys.empty()) {
+        return;
+    }
+    for (const auto &key : fRegisteredTSKeys) {
+        auto &labels = fSeriesLabels[key];
+        if (fRunNumber.empty()) {
+            labels.erase(RunNumber.data());
+        } else {
+            labels[RunNumber.data()] = fRunNumber;
         }
     }
+    // ts.alter is sent by the publisher (again after an outage of the server)
+    if (!fRunLabelsPending) {
+        Queued(fRegisteredTSKeys.size() * (1 + fCompactionRules.size()));
+    }
+    fRunLabelsPending = true;
+    Push(MetricRecord{}); // flush
+}
+
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::DeleteExpiredFields()
+{
+    // one script call per MaxExpiredPerCall expired instances (no round trip per live instance).
+    // the instances of the previous versions are added to the sorted set by MigrateFieldIndex().
+    try {
+        const auto threshold   = to_msec(std::chrono::system_clock::now()) - fMaxTtl;
+        const auto indexPrefix = fFieldIndexKey.substr(0, fFieldIndexKey.size() - fId.size());
+        std::vector<std::string> keys{fLastUpdateIndexKey};
+        keys.insert(keys.end(), fRegisteredKeys.cbegin(), fRegisteredKeys.cend());
+        const std::vector<std::string> args{std::to_string(threshold), indexPrefix, std::to_string(MaxExpiredPerCall)};
+        long long nInstances{0};
+        long long nFields{0};
+        std::vector<long long> ret;
+        do {
+            ret.clear();
+            fClient->eval(lua::DeleteExpiredFields.data(), keys.cbegin(), keys.cend(), args.cbegin(), args.cend(), std::back_inserter(ret));
+            if (ret.size() != 2) {
+                break;
+            }
+            nInstances += ret[0];
+            nFields    += ret[1];
+        } while (ret[0] >= MaxExpiredPerCall);
+        LOG(debug) << MyClass << " " << __FUNCTION__ << " n instances = " << nInstances << ", n deleted = " << nFields;
+    } catch (const sw::redis::Error& e) {
+        LOG(error) << " caught exception (redis++) : " << e.what();
+    } catch (const std::exception& e) {
+        LOG(error) << " caught exception (std) : " << e.what();
+    } catch (...) {
+        LOG(error) << " caught exception : unknown";
+    }
 }
 
 //_____________________________________________________________________________
 void daq::service::MetricsPlugin::DeleteTSKeys()
 {
+    fPendingTSKeys.clear();
+    // the series of the run are also removed from the exporters (e.g. the entries of the shm table are freed)
+    for (const auto &key : fRegisteredTSKeys) {
+        for (auto &e : fExporters) {
+            e->Remove(key);
+        }
+    }
+    if (!fRegisteredTSKeys.empty() && !fTsRedis) {
+        fRegisteredTSKeys.clear();
+    }
     if (!fRegisteredTSKeys.empty()) {
-        auto ndeleted = fClient->del(fRegisteredTSKeys.cbegin(), fRegisteredTSKeys.cend());
+        // called from the publisher thread. the deletion is sent with the next flush.
+        if (fPendingDelKeys.empty()) {
+            Queued();
+        }
+        fPendingDelKeys.insert(fPendingDelKeys.end(), fRegisteredTSKeys.cbegin(), fRegisteredTSKeys.cend());
+        LOG(debug) << MyClass << " " << __FUNCTION__ << " n keys = " << fRegisteredTSKeys.size();
         fRegisteredTSKeys.clear();
-        LOG(debug) << MyClass << " " << __FUNCTION__ << " n deleted = " << ndeleted;
     }
 }
 
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::EndRun()
+{
+    if (fRunning) {
+        WriteRunSummary();
+        fRunning = false;
+    }
+    if (IsRecreateTS()) {
+        // the samples of the run are sent before the series are deleted
+        Exec();
+        DeleteTSKeys();
+    }
+    fSocketMetrics.clear();
+    fNumChannels.clear();
+    Exec();
+}
+
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::Exec()
+{
+    RecoverPipe();
+    if (!fPipe) {
+        // server unreachable: the samples are kept in the spool and the one-shot writes until the recovery.
+        // the periodic hashes are not queued (overwritten by the next update).
+        SpoolSamples(fTsSamples);
+        fTsSamples.clear();
+        fSocketFields.clear();
+        fNumQueuedCommands = 0;
+        for (auto &e : fExporters) {
+            e->Flush();
+        }
+        return;
+    }
+    const auto nDropped = fNumDropped.load(std::memory_order_relaxed);
+    if (nDropped != fNumDroppedPublished) {
+        LOG(warn) << MyClass << " metrics dropped (queue overflow or spool). n dropped = " << nDropped;
+        fPipe->hset(fDroppedKey, {std::make_pair(fId, nDropped)});
+    }
+    if (!fSocketFields.empty()) {
+        fPipe->hset(fSocketKey, fSocketFields.cbegin(), fSocketFields.cend());
+        if (fMaxTtl>0) {
+            fPipe->pexpire(fSocketKey, fMaxTtl);
+        }
+        fSocketFields.clear();
+    }
+    for (const auto &[key, fields] : fPendingHashes) {
+        fPipe->hset(key, fields.cbegin(), fields.cend());
+    }
+    if (!fPendingDelKeys.empty()) {
+        fPipe->del(fPendingDelKeys.cbegin(), fPendingDelKeys.cend());
+    }
+    if (!fPendingIndexFields.empty()) {
+        fPipe->sadd(fFieldIndexKey, fPendingIndexFields.cbegin(), fPendingIndexFields.cend());
+    }
+    std::vector<std::string> tsKeys;
+    std::vector<std::string> serviceKeys;
+    tsKeys.swap(fPendingTSKeys);
+    serviceKeys.swap(fPendingServiceKeys);
+    if (fRunLabelsPending) {
+        QueueRunLabels(tsKeys);
+    }
+    QueueCreateTimeseries(tsKeys, IsRecreateTS() ? "recreate" : "retain", "");
+    QueueCreateTimeseries(serviceKeys, "shared", "SUM");
+    std::vector<std::string> samples;
+    samples.swap(fTsSamples);
+    if (fTsMadd && !samples.empty()) {
+        fPipe->command(samples.cbegin(), samples.cend());
+    } else {
+        for (auto i = 1u; i + 2 < samples.size(); i += 3) {
+            fPipe->command("ts.add", samples[i], samples[i+1], samples[i+2]);
+        }
+    }
+    // the latency is the one of the previous flush
+    fPipe->hset(fQueuedCommandsKey, {std::make_pair(fId, fNumQueuedCommands)})
+    .hset(fFlushLatencyKey, {std::make_pair(fId, fFlushLatency.count())});
+    fNumQueuedCommands = 0;
+
+    // the pipeline is sent by SendFlush() after fMutex is released. the one-shot writes are moved to the batch
+    // (appended if Exec() is called again before, e.g. in EndRun()) and restored if the server is unreachable.
+    fFlush.ready    = true;
+    fFlush.nDropped = nDropped;
+    fFlush.samples.insert(fFlush.samples.end(), samples.cbegin(), samples.cend());
+    fFlush.tsKeys.insert(fFlush.tsKeys.end(), tsKeys.cbegin(), tsKeys.cend());
+    fFlush.serviceKeys.insert(fFlush.serviceKeys.end(), serviceKeys.cbegin(), serviceKeys.cend());
+    for (auto &[key, fields] : fPendingHashes) {
+        for (auto &[field, value] : fields) {
+            fFlush.hashes[key][field] = std::move(value);
+        }
+    }
+    fFlush.delKeys.insert(fFlush.delKeys.end(), fPendingDelKeys.cbegin(), fPendingDelKeys.cend());
+    fFlush.indexFields.insert(fFlush.indexFields.end(), fPendingIndexFields.cbegin(), fPendingIndexFields.cend());
+    fFlush.runLabels |= fRunLabelsPending;
+    fPendingHashes.clear();
+    fPendingDelKeys.clear();
+    fPendingIndexFields.clear();
+    fRunLabelsPending = false;
+
+    for (auto &e : fExporters) {
+        e->Flush();
+    }
+}
+
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::QueueCreateTimeseries(const std::vector<std::string> &keys,
+        std::string_view mode,
+        std::string_view duplicatePolicy)
+{
+    if (keys.empty()) {
+        return;
+    }
+    const auto args = CreateTimeseriesArgs(keys, mode, duplicatePolicy);
+    fPipe->eval(lua::CreateTimeseries.data(), keys.cbegin(), keys.cend(), args.cbegin(), args.cend());
+}
+
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::QueueHash(const std::string &key, const std::string &field, const std::string &value)
+{
+    // one hset per key and flush. the latest value of a field is sent.
+    auto &fields = fPendingHashes[key];
+    if (fields.empty()) {
+        Queued();
+    }
+    fields[field] = value;
+}
+
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::QueueRunLabels(const std::vector<std::string> &createdKeys)
+{
+    // ts.alter replaces all labels. the series created in the same flush already have the new labels.
+    std::vector<std::string> cmd;
+    for (const auto &key : fRegisteredTSKeys) {
+        if (std::find(createdKeys.cbegin(), createdKeys.cend(), key) != createdKeys.cend()) {
+            continue;
+        }
+        const auto &labels = fSeriesLabels[key];
+        cmd.clear();
+        cmd.push_back("ts.alter");
+        cmd.push_back(key);
+        cmd.push_back("labels");
+        for (const auto &[k, v] : labels) {
+            cmd.push_back(k);
+            cmd.push_back(v);
+        }
+        fPipe->command(cmd.cbegin(), cmd.cend());
+        // compacted series: same labels + compaction
+        cmd.push_back(Compaction.data());
+        cmd.push_back("");
+        for (const auto &r : fCompactionRules) {
+            cmd[1] = join({key, r.name}, fSeparator);
+            cmd.back() = r.name;
+            fPipe->command(cmd.cbegin(), cmd.cend());
+        }
+    }
+}
+
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::FlushIfDue()
+{
+    if (fNumQueuedCommands==0) {
+        return;
+    }
+    const auto tooOld = (fFlushMaxAge>0)
+                        && (std::chrono::steady_clock::now() - fOldestQueuedTime >= std::chrono::milliseconds(fFlushMaxAge));
+    if (!tooOld && (fNumQueuedCommands < fFlushMaxCommands)) {
+        return;
+    }
+    try {
+        if (tooOld) {
+            // some sub-channels have not reported (idle or removed peer). flush the partial round.
+            fNumChannels.clear();
+        }
+        Exec();
+    } catch (const std::exception &e) {
+        std::cerr << MyClass << " " << __FUNCTION__ << " exception : what() = " << e.what();
+    } catch (...) {
+        std::cerr << MyClass << " " << __FUNCTION__ << " exception : unknown";
+    }
+}
+
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::IndexField(const std::string &key, const std::string &field)
+{
+    if (fMaxTtl<=0) {
+        // the index is used only to delete the fields of expired instances
+        return;
+    }
+    auto f = key + "\t" + field;
+    if (fIndexedFields.count(f)>0) {
+        return;
+    }
+    if (fPendingIndexFields.empty()) {
+        Queued();
+    }
+    fPendingIndexFields.push_back(f);
+    fIndexedFields.insert(std::move(f));
+}
+
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::InitializeShmMetrics()
+{
+    auto useShm = PropertyExists("transport") && (GetProperty<std::string>("transport")=="shmem");
+    for (const auto& [name, p] : fSocketProperties) {
+        useShm |= (p.transport=="shmem");
+    }
+
+    std::lock_guard<std::mutex> lock{fMutex};
+    fShmMetrics = useShm;
+    if (!fShmMetrics) {
+        return;
+    }
+    fShmSession     = GetProperty<std::string>("session");
+    fShmId          = fair::mq::shmem::makeShmIdStr(fShmSession);
+    fShmSegmentId   = GetProperty<uint16_t>("shm-segment-id");
+    fShmSegmentSize = GetProperty<std::size_t>("shm-segment-size");
+    LOG(debug) << MyClass << " shm metrics: session = " << fShmSession << ", shm id = " << fShmId
+               << ", segment id = " << fShmSegmentId << ", segment size = " << fShmSegmentSize;
+}
+
 //_____________________________________________________________________________
 void daq::service::MetricsPlugin::InitializeSocketProperties()
 {
@@ -605,28 +1262,84 @@ bool daq::service::MetricsPlugin::IsRecreateTS()
 }
 
 //_____________________________________________________________________________
-daq::service::ProcSelfStat_t daq::service::MetricsPlugin::ReadProcSelfStat()
+void daq::service::MetricsPlugin::MigrateFieldIndex()
 {
-    if (!fProcSelfStatFile.is_open()) {
-        fProcSelfStatFile.open("/proc/self/stat");
+    // one-time migration (metrics-migrate-index=true): instances which are not in the sorted set are added to it,
+    // so that DeleteExpiredFields() deletes their fields when they are expired.
+    //  - instances of the previous versions, only in the hash last-update-ns (nanoseconds since epoch)
+    //  - field index of an instance which has never been added to the sorted set (score 0 = expired)
+    // ZADD NX: the instances in the sorted set are not changed.
+    try {
+        std::unordered_map<std::string, std::string> lastUpdateNS;
+        fClient->hgetall(fLastUpdateNSKey, std::inserter(lastUpdateNS, lastUpdateNS.end()));
+        const auto indexPrefix = fFieldIndexKey.substr(0, fFieldIndexKey.size() - fId.size());
+        std::vector<std::string> indexKeys;
+        auto cursor = 0LL;
+        do {
+            cursor = fClient->scan(cursor, indexPrefix + "*", 1000, std::back_inserter(indexKeys));
+        } while (cursor != 0);
+
+        std::vector<std::string> cmd{"zadd", fLastUpdateIndexKey, "nx"};
+        for (const auto &[id, ns] : lastUpdateNS) {
+            cmd.push_back(std::to_string(std::strtoll(ns.data(), nullptr, 10) / 1000000));
+            cmd.push_back(id);
+        }
+        for (const auto &k : indexKeys) {
+            cmd.push_back("0");
+            cmd.push_back(k.substr(indexPrefix.size()));
+        }
+        long long n{0};
+        if (cmd.size() > 3) {
+            n = fClient->command<long long>(cmd.cbegin(), cmd.cend());
+        }
+        LOG(info) << MyClass << " " << __FUNCTION__ << " n instances added to " << fLastUpdateIndexKey << " = " << n;
+    } catch (const sw::redis::Error& e) {
+        LOG(error) << " caught exception (redis++) : " << e.what();
     }
-    std::string s;
-    std::vector<std::string> v;
-    std::getline(fProcSelfStatFile, s);
-    // clear iostate flag and seek to the beginning of the file
-    fProcSelfStatFile.clear();
-    fProcSelfStatFile.seekg(0);
-    boost::split(v, s, boost::is_space()); //, boost::token_compress_on);
+}
 
-//  LOG(debug) << "/proc/self/stat \n" << s;
-//  LOG(debug) << " v.size() = " << v.size();
-//  LOG(debug) << v[Utime] << " " << v[Stime] << " " << v[Vsize] << " " << v[Rss];
+//_____________________________________________________________________________
+daq::service::ProcSelfStat_t daq::service::MetricsPlugin::ReadProcSelfStat()
+{
+    if (!fProcSelfStatFile.IsOpen()) {
+        fProcSelfStatFile.Open("/proc/self/stat");
+    }
+    char buf[ProcFile::BufferSize];
+    auto s = fProcSelfStatFile.Read(buf, sizeof(buf));
 
     ProcSelfStat_t ret;
-    ret.utime = std::stoull(v[Utime]);
-    ret.stime = std::stoull(v[Stime]);
-    ret.vsize = std::stoull(v[Vsize]);
-    ret.rss   = std::stoull(v[Rss]);
+    // comm (in parentheses) may contain white spaces. start after the last ')'
+    const auto p = s.rfind(')');
+    if (p == std::string_view::npos) {
+        return ret;
+    }
+    s.remove_prefix(p+1);
+    for (int i=State; i<=Rss; ++i) {
+        const auto f = NextField(s);
+        switch (i) {
+        case Utime:
+            ret.utime = ToUInt64(f);
+            break;
+        case Stime:
+            ret.stime = ToUInt64(f);
+            break;
+        case MinFlt:
+            ret.minflt = ToUInt64(f);
+            break;
+        case MajFlt:
+            ret.majflt = ToUInt64(f);
+            break;
+        case Vsize:
+            ret.vsize = ToUInt64(f);
+            break;
+        case Rss:
+            ret.rss   = ToUInt64(f);
+            break;
+        default:
+            break;
+        }
+    }
+//  LOG(debug) << ret.utime << " " << ret.stime << " " << ret.vsize << " " << ret.rss;
 
     return ret;
 }
@@ -635,42 +1348,555 @@ daq::service::ProcSelfStat_t daq::service::MetricsPlugin::ReadProcSelfStat()
 daq::service::ProcStat_t daq::service::MetricsPlugin::ReadProcStat()
 {
     //LOG(debug) << MyClass << " " << __FUNCTION__;
-    if (!fProcStatFile.is_open()) {
-        fProcStatFile.open("/proc/stat");
+    if (!fProcStatFile.IsOpen()) {
+        fProcStatFile.Open("/proc/stat");
+    }
+    // the aggregated "cpu " line is the first line of /proc/stat
+    char buf[ProcFile::BufferSize];
+    auto s = fProcStatFile.Read(buf, sizeof(buf));
+
+    ProcStat_t ret;
+    if (s.compare(0, 4, "cpu ") != 0) {
+        return ret;
     }
-    std::string s;
-    while (std::getline(fProcStatFile, s)) {
-        if (s.find("cpu ")==0) {
+    s = s.substr(0, s.find('\n'));
+    for (int i=0; i<=Idle; ++i) {
+        const auto f = NextField(s);
+        switch (i) {
+        case User:
+            ret.user   = ToUInt64(f);
+            break;
+        case Nice:
+            ret.nice   = ToUInt64(f);
+            break;
+        case System:
+            ret.system = ToUInt64(f);
+            break;
+        case Idle:
+            ret.idle   = ToUInt64(f);
+            break;
+        default:
             break;
         }
     }
-    // clear iostate flag and seek to the beginning of the file
-    fProcStatFile.clear();
-    fProcStatFile.seekg(0);
-
-    std::vector<std::string> v;
-    boost::trim_if(s, boost::is_space());
-    boost::split(v, s, boost::is_space(), boost::token_compress_on);
-//  LOG(debug) << "/proc/stat \n" << s;
-//  LOG(debug) << " v.size() = " << v.size();
-//  LOG(debug) << " User = " << User << ", Nice = " << Nice << ", System = " << System << ", Idle = " << Idle;
-//  for (auto i=0; i<v.size(); ++i) {
-//    LOG(debug) << " i = " << i << " " << v[i];
-//  }
-//  LOG(debug) << v[User] << " " << v[Nice] << " " << v[System] << " " << v[Idle];
-    ProcStat_t ret;
-    ret.user   = std::stoull(v[User]);
-    ret.nice   = std::stoull(v[Nice]);
-    ret.system = std::stoull(v[System]);
-    ret.idle   = std::stoull(v[Idle]);
+//  LOG(debug) << ret.user << " " << ret.nice << " " << ret.system << " " << ret.idle;
 
     return ret;
 }
 
 //_____________________________________________________________________________
-void daq::service::MetricsPlugin::SendProcessMetrics()
+daq::service::IoStat_t daq::service::MetricsPlugin::ReadIoStat(const ProcSelfStat_t &procSelfStat)
 {
-    //std::cout << MyClass << " " << __FUNCTION__;
+    IoStat_t ret;
+    ret.minflt = procSelfStat.minflt;
+    ret.majflt = procSelfStat.majflt;
+
+    // "<name>: <rx bytes> <packets> <errs> <drop> <fifo> <frame> <compressed> <multicast> <tx bytes> <packets> <errs> <drop> ..."
+    if (!fNic.empty()) {
+        auto s = fProcNetDevFile.Read(fNetDevBuffer.data(), fNetDevBuffer.size());
+        while (!s.empty()) {
+            const auto e = s.find('\n');
+            auto line = s.substr(0, e);
+            s.remove_prefix((e == std::string_view::npos) ? s.size() : e + 1);
+            const auto colon = line.find(':');
+            if (colon == std::string_view::npos) {
+                continue;
+            }
+            auto name = line.substr(0, colon);
+            name.remove_prefix(std::min(name.find_first_not_of(' '), name.size()));
+            if (name != fNic) {
+                continue;
+            }
+            line.remove_prefix(colon + 1);
+            uint64_t v[12]{};
+            for (auto &x : v) {
+                x = ToUInt64(NextField(line));
+            }
+            ret.rxBytes   = v[0];
+            ret.rxPackets = v[1];
+            ret.rxErrors  = v[2];
+            ret.rxDropped = v[3];
+            ret.txBytes   = v[8];
+            ret.txPackets = v[9];
+            ret.txErrors  = v[10];
+            ret.txDropped = v[11];
+            break;
+        }
+    }
+
+    // "read_bytes: <n>" and "write_bytes: <n>"
+    char buf[ProcFile::BufferSize];
+    const auto s = fProcSelfIoFile.Read(buf, sizeof(buf));
+    auto readValue = [s](std::string_view name) -> uint64_t {
+        const auto q = s.find(name);
+        if (q == std::string_view::npos) {
+            return 0;
+        }
+        auto v = s.substr(q + name.size());
+        return ToUInt64(NextField(v));
+    };
+    ret.readBytes  = readValue("\nread_bytes:");
+    ret.writeBytes = readValue("\nwrite_bytes:");
+
+    return ret;
+}
+
+//_____________________________________________________________________________
+daq::service::ThreadStat_t daq::service::MetricsPlugin::ReadThreadStat(ThreadEntry &t)
+{
+    char buf[ProcFile::BufferSize];
+    ThreadStat_t ret;
+
+    // stat: same layout as /proc/self/stat
+    auto s = t.stat.Read(buf, sizeof(buf));
+    const auto p = s.rfind(')');
+    if (p != std::string_view::npos) {
+        s.remove_prefix(p+1);
+        for (int i=State; i<=Stime; ++i) {
+            const auto f = NextField(s);
+            if (i==Utime) {
+                ret.utime = ToUInt64(f);
+            } else if (i==Stime) {
+                ret.stime = ToUInt64(f);
+            }
+        }
+    }
+
+    // status: "voluntary_ctxt_switches:\t<n>" and "nonvoluntary_ctxt_switches:\t<n>"
+    s = t.status.Read(buf, sizeof(buf));
+    auto readValue = [s](std::string_view name) -> uint64_t {
+        const auto q = s.find(name);
+        if (q == std::string_view::npos) {
+            return 0;
+        }
+        auto v = s.substr(q + name.size());
+        return ToUInt64(NextField(v));
+    };
+    ret.voluntary    = readValue("\nvoluntary_ctxt_switches:");
+    ret.nonvoluntary = readValue("\nnonvoluntary_ctxt_switches:");
+
+    // schedstat: <time on cpu (ns)> <time waiting on a run queue (ns)> <number of timeslices>
+    s = t.schedstat.Read(buf, sizeof(buf));
+    NextField(s);
+    ret.runDelay = ToUInt64(NextField(s));
+
+    return ret;
+}
+
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::SendThreadMetrics(int64_t timestamp, uint64_t diffAll)
+{
+    auto dir = opendir("/proc/self/task");
+    if (dir == nullptr) {
+        return;
+    }
+    auto diff = [](uint64_t now, uint64_t last) {
+        return (now > last) ? (now - last) : 0;
+    };
+
+    ++fThreadGeneration;
+    while (auto e = readdir(dir)) {
+        int tid{0};
+        const auto n = std::strlen(e->d_name);
+        const auto [ptr, ec] = std::from_chars(e->d_name, e->d_name + n, tid);
+        if ((ec != std::errc()) || (ptr != e->d_name + n) || (tid <= 0)) {
+            // "." and ".."
+            continue;
+        }
+        auto [itr, isNew] = fThreads.try_emplace(tid);
+        auto &t = itr->second;
+        t.generation = fThreadGeneration;
+        if (isNew) {
+            const auto taskDir = "/proc/self/task/"s + e->d_name + "/";
+            t.stat.Open(taskDir + "stat");
+            t.status.Open(taskDir + "status");
+            t.schedstat.Open(taskDir + "schedstat");
+
+            // thread name (comm) in parentheses
+            char buf[ProcFile::BufferSize];
+            const auto c = t.stat.Read(buf, sizeof(buf));
+            const auto b = c.find('(');
+            const auto l = c.rfind(')');
+            if ((b != std::string_view::npos) && (l != std::string_view::npos) && (b < l)) {
+                t.name = c.substr(b+1, l-b-1);
+            }
+
+            const auto prefix = join({"ts", fId, ThreadPrefix.data(), std::to_string(tid)}, fSeparator);
+            t.tsKey.cpu             = join({prefix, "cpu"},          fSeparator);
+            t.tsKey.ctxVoluntary    = join({prefix, "ctxsw-vol"},    fSeparator);
+            t.tsKey.ctxNonvoluntary = join({prefix, "ctxsw-nonvol"}, fSeparator);
+            t.tsKey.runDelay        = join({prefix, "run-delay"},    fSeparator);
+            // the first sample is the reference
+            t.last = ReadThreadStat(t);
+            continue;
+        }
+
+        if (fRegisteredTSKeys.count(t.tsKey.cpu)==0) {
+            // (re-)created after the deletion on the transition to Ready
+            std::unordered_map<std::string, std::string> labels{{ThreadName.data(), t.name},
+                {ThreadId.data(), std::to_string(tid)}};
+            auto create = [this, &labels](const std::string &key, std::string_view dataType) {
+                auto l = labels;
+                l.emplace(DataType.data(), dataType.data());
+                CreateTimeseries(key, l);
+            };
+            create(t.tsKey.cpu,             ThreadCpuPrefix);
+            create(t.tsKey.ctxVoluntary,    ThreadCtxVoluntaryPrefix);
+            create(t.tsKey.ctxNonvoluntary, ThreadCtxNonvoluntaryPrefix);
+            create(t.tsKey.runDelay,        ThreadRunDelayPrefix);
+        }
+
+        auto now = ReadThreadStat(t);
+        // cpu usage in percent (same scale as the process cpu usage)
+        const auto cpuUsage = (diffAll>0) ? static_cast<double>(diff(now.sum(), t.last.sum()))/diffAll * fNCpuCores * fClockTick : 0.0;
+        // run-queue delay in milliseconds during the interval
+        const auto runDelay = static_cast<double>(diff(now.runDelay, t.last.runDelay))/1e6;
+        AddSample(t.tsKey.cpu,             timestamp, std::to_string(cpuUsage));
+        AddSample(t.tsKey.ctxVoluntary,    timestamp, std::to_string(diff(now.voluntary,    t.last.voluntary)));
+        AddSample(t.tsKey.ctxNonvoluntary, timestamp, std::to_string(diff(now.nonvoluntary, t.last.nonvoluntary)));
+        AddSample(t.tsKey.runDelay,        timestamp, std::to_string(runDelay));
+        t.last = now;
+    }
+    closedir(dir);
+
+    // remove exited threads and their series
+    std::vector<std::string> exited;
+    for (auto itr = fThreads.begin(); itr != fThreads.end();) {
+        if (itr->second.generation != fThreadGeneration) {
+            const auto &k = itr->second.tsKey;
+            for (const auto &key : {k.cpu, k.ctxVoluntary, k.ctxNonvoluntary, k.runDelay}) {
+                if (fRegisteredTSKeys.erase(key) > 0) {
+                    exited.push_back(key);
+                }
+                fSeriesLabels.erase(key);
+                for (auto &e : fExporters) {
+                    e->Remove(key);
+                }
+            }
+            itr = fThreads.erase(itr);
+        } else {
+            ++itr;
+        }
+    }
+    if (exited.empty() || !fTsRedis) {
+        return;
+    }
+    // not created yet: the creation script must not run after the deletion
+    fPendingTSKeys.erase(std::remove_if(fPendingTSKeys.begin(), fPendingTSKeys.end(), [&exited](const auto &key) {
+        return std::find(exited.cbegin(), exited.cend(), key) != exited.cend();
+    }), fPendingTSKeys.end());
+    const auto n = exited.size();
+    for (auto i = 0u; i < n; ++i) {
+        for (const auto &r : fCompactionRules) {
+            exited.push_back(join({exited[i], r.name}, fSeparator));
+        }
+    }
+    if (fPendingDelKeys.empty()) {
+        Queued();
+    }
+    fPendingDelKeys.insert(fPendingDelKeys.end(), exited.cbegin(), exited.cend());
+}
+
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::SendIoMetrics(int64_t timestamp, const ProcSelfStat_t &procSelfStat)
+{
+    // [0, NumNicMetrics) are written only if the network interface is known
+    static constexpr std::size_t NumNicMetrics{10};
+    static constexpr std::array<std::string_view, 14> Metrics{
+        NicRxBytesPrefix, NicTxBytesPrefix, NicRxPacketsPrefix, NicTxPacketsPrefix,
+        NicRxDropPrefix,  NicTxDropPrefix,  NicRxErrorPrefix,   NicTxErrorPrefix,
+        NicRxUtilPrefix,  NicTxUtilPrefix,
+        IoReadPrefix, IoWritePrefix, MinorFaultPrefix, MajorFaultPrefix};
+    auto diff = [](uint64_t now, uint64_t last) {
+        return (now > last) ? (now - last) : 0;
+    };
+
+    if (!fIoInitialized) {
+        fIoInitialized = true;
+        // set by the daq_service plugin (resolved from host-ip or the default route)
+        if (PropertyExists("network-interface")) {
+            fNic = GetProperty<std::string>("network-interface");
+            if (fNic == "default") {
+                fNic = fair::mq::tools::getDefaultRouteNetworkInterface();
+            }
+        }
+        if (!fNic.empty()) {
+            fProcNetDevFile.Open("/proc/net/dev");
+            fNetDevBuffer.resize(64 * 1024);
+            // Mb/s. -1 for virtual interfaces
+            ProcFile speedFile("/sys/class/net/" + fNic + "/speed");
+            char buf[64];
+            auto v = speedFile.Read(buf, sizeof(buf));
+            fNicSpeed = static_cast<double>(ToUInt64(NextField(v)));
+        }
+        fProcSelfIoFile.Open("/proc/self/io");
+        LOG(debug) << MyClass << " io metrics: nic = " << fNic << ", speed = " << fNicSpeed << " Mb/s";
+        for (const auto &metric : Metrics) {
+            fTsIoKey.push_back(join({"ts", fId, metric.data()}, fSeparator));
+        }
+        // the first sample is the reference
+        fIoStat = ReadIoStat(procSelfStat);
+        fIoSampleTime = std::chrono::steady_clock::now();
+        return;
+    }
+
+    if (fRegisteredTSKeys.count(fTsIoKey.back())==0) {
+        // (re-)created after the deletion on the transition to Ready
+        for (auto i = fNic.empty() ? NumNicMetrics : 0; i < Metrics.size(); ++i) {
+            std::unordered_map<std::string, std::string> labels{{DataType.data(), Metrics[i].data()}};
+            if (i < NumNicMetrics) {
+                labels.emplace(NetworkInterface.data(), fNic);
+            }
+            CreateTimeseries(fTsIoKey[i], labels);
+        }
+    }
+
+    const auto now = ReadIoStat(procSelfStat);
+    const auto t   = std::chrono::steady_clock::now();
+    const double dt = std::chrono::duration<double>(t - fIoSampleTime).count();
+    fIoSampleTime = t;
+    if (dt <= 0) {
+        return;
+    }
+    // bytes and packets per second (MB = 1e6 bytes, same as the socket metrics), drops, errors and page faults per interval
+    std::array<double, Metrics.size()> values{};
+    values[0]  = diff(now.rxBytes,   fIoStat.rxBytes)   / dt / 1e6;
+    values[1]  = diff(now.txBytes,   fIoStat.txBytes)   / dt / 1e6;
+    values[2]  = diff(now.rxPackets, fIoStat.rxPackets) / dt;
+    values[3]  = diff(now.txPackets, fIoStat.txPackets) / dt;
+    values[4]  = diff(now.rxDropped, fIoStat.rxDropped);
+    values[5]  = diff(now.txDropped, fIoStat.txDropped);
+    values[6]  = diff(now.rxErrors,  fIoStat.rxErrors);
+    values[7]  = diff(now.txErrors,  fIoStat.txErrors);
+    // link utilization in percent
+    values[8]  = (fNicSpeed > 0) ? values[0] * 8 / fNicSpeed * 100 : 0.0;
+    values[9]  = (fNicSpeed > 0) ? values[1] * 8 / fNicSpeed * 100 : 0.0;
+    values[10] = diff(now.readBytes,  fIoStat.readBytes)  / dt / 1e6;
+    values[11] = diff(now.writeBytes, fIoStat.writeBytes) / dt / 1e6;
+    values[12] = diff(now.minflt, fIoStat.minflt);
+    values[13] = diff(now.majflt, fIoStat.majflt);
+    fIoStat = now;
+
+    for (auto i = fNic.empty() ? NumNicMetrics : 0; i < Metrics.size(); ++i) {
+        AddSample(fTsIoKey[i], timestamp, std::to_string(values[i]));
+    }
+}
+
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::SendQueueMetrics(int64_t timestamp)
+{
+    static constexpr std::array<std::string_view, 5> Metrics{QueueDepthPrefix, QueueHighWaterPrefix, QueueFullPrefix,
+                                                             SendBlockedPrefix, RecvWaitPrefix};
+
+    // blocked and waiting times in percent of the sampling interval
+    const auto now = std::chrono::steady_clock::now();
+    const double dt = std::chrono::duration<double, std::nano>(now - fQueueSampleTime).count();
+    fQueueSampleTime = now;
+    if (dt <= 0) {
+        return;
+    }
+
+    ChannelQueueStats::Snapshot snapshot;
+    for (const auto &[channelName, subChannels] : fChannelQueues->GetAll()) {
+        for (auto i = 0u; i < subChannels.size(); ++i) {
+            const auto subChannelName = channelName + "[" + std::to_string(i) + "]";
+            auto itr = fTsQueueKey.find(subChannelName);
+            if (itr == fTsQueueKey.end()) {
+                std::vector<std::string> keys;
+                for (const auto &metric : Metrics) {
+                    keys.push_back(join({"ts", fId, subChannelName, metric.data()}, fSeparator));
+                }
+                itr = fTsQueueKey.emplace(subChannelName, std::move(keys)).first;
+            }
+            const auto &keys = itr->second;
+
+            if (fRegisteredTSKeys.count(keys.front())==0) {
+                // same labels as the socket metrics
+                std::unordered_map<std::string, std::string> labels;
+                if (auto p = fSocketProperties.find(subChannelName); p != fSocketProperties.end()) {
+                    labels = {{SocketName.data(),      p->second.name},
+                              {SocketType.data(),      p->second.type},
+                              {SocketTransport.data(), p->second.transport}};
+                }
+                for (auto m = 0u; m < Metrics.size(); ++m) {
+                    auto l = labels;
+                    l.emplace(DataType.data(), Metrics[m].data());
+                    CreateTimeseries(keys[m], l);
+                }
+            }
+
+            subChannels[i]->Collect(snapshot);
+            AddSample(keys[0], timestamp, std::to_string(snapshot.depth));
+            AddSample(keys[1], timestamp, std::to_string(snapshot.highWater));
+            AddSample(keys[2], timestamp, std::to_string(snapshot.nFull));
+            AddSample(keys[3], timestamp, std::to_string(snapshot.sendBlockedNs / dt * 100));
+            AddSample(keys[4], timestamp, std::to_string(snapshot.recvWaitNs    / dt * 100));
+        }
+    }
+}
+
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::SendShmMetrics(int64_t timestamp)
+{
+    unsigned long freeBytes{0};
+    try {
+        freeBytes = fair::mq::shmem::Monitor::GetFreeMemory(fair::mq::shmem::SessionId{fShmSession}, fShmSegmentId);
+    } catch (const std::exception &) {
+        // the segment is created by the transport at the first use
+        return;
+    }
+    const auto usedBytes = (fShmSegmentSize > freeBytes) ? (fShmSegmentSize - freeBytes) : 0;
+
+    // unmanaged regions: /dev/shm/fmq_<shm-id>_rg_<region-id>
+    std::size_t nRegions{0};
+    if (auto dir = opendir("/dev/shm")) {
+        const auto prefix = "fmq_" + fShmId + "_rg_";
+        while (auto e = readdir(dir)) {
+            if (std::strncmp(e->d_name, prefix.data(), prefix.size())==0) {
+                ++nRegions;
+            }
+        }
+        closedir(dir);
+    }
+
+    if (fRegisteredTSKeys.count(fTsShmKey.used)==0) {
+        // same as the process metrics: not tied to the Running state
+        CreateTimeseries(fTsShmKey.used,    {{DataType.data(), ShmUsedPrefix.data()}});
+        CreateTimeseries(fTsShmKey.free,    {{DataType.data(), ShmFreePrefix.data()}});
+        CreateTimeseries(fTsShmKey.regions, {{DataType.data(), ShmRegionsPrefix.data()}});
+    }
+    if (fPipe) {
+        fPipe->hset(fShmKey.used,    {std::make_pair(fId, usedBytes)})
+        .hset(fShmKey.free,    {std::make_pair(fId, freeBytes)})
+        .hset(fShmKey.regions, {std::make_pair(fId, nRegions)});
+        Queued(3);
+    }
+    AddSample(fTsShmKey.used,    timestamp, std::to_string(usedBytes));
+    AddSample(fTsShmKey.free,    timestamp, std::to_string(freeBytes));
+    AddSample(fTsShmKey.regions, timestamp, std::to_string(nRegions));
+}
+
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::SendCustomMetrics(int64_t timestamp)
+{
+    static constexpr std::array<double, 3> Quantiles{0.5, 0.9, 0.99};
+
+    const auto now = std::chrono::steady_clock::now();
+    const double dt = std::chrono::duration<double>(now - fCustomSampleTime).count();
+    fCustomSampleTime = now;
+
+    // returns the ts keys of a metric. the time series are created on first use
+    auto getKeys = [this](const std::string &name, std::string_view kind, std::initializer_list<std::string_view> suffixes)
+    -> const std::vector<std::string>& {
+        // a counter, a gauge and a histogram may have the same name: the kind is a part of the key
+        const auto customKey = std::string(kind) + "\t" + name;
+        auto itr = fTsCustomKey.find(customKey);
+        if (itr == fTsCustomKey.end()) {
+            std::vector<std::string> keys;
+            for (const auto &suffix : suffixes) {
+                keys.push_back(join({"ts", fId, CustomPrefix.data(), kind.data(),
+                                     suffix.empty() ? name : join({name, suffix.data()}, "-")}, fSeparator));
+            }
+            itr = fTsCustomKey.emplace(customKey, std::move(keys)).first;
+        }
+        const auto &keys = itr->second;
+        if (fRegisteredTSKeys.count(keys.front())==0) {
+            for (const auto &k : keys) {
+                CreateTimeseries(k, {{DataType.data(), k.substr(k.rfind(fSeparator) + fSeparator.size())},
+                                     {CustomKind.data(), kind.data()}});
+            }
+        }
+        return keys;
+    };
+
+    fCustomMetrics->Visit([&](const auto &counters, const auto &gauges, const auto &histograms) {
+        for (const auto &[name, c] : counters) {
+            const auto &keys  = getKeys(name, "counter", {"", "rate"});
+            const auto value  = c->Value();
+            auto [last, isNew] = fCustomCounterLast.try_emplace(name, value);
+            AddSample(keys[0], timestamp, std::to_string(value));
+            if (!isNew && (dt > 0)) {
+                AddSample(keys[1], timestamp, std::to_string((value - last->second) / dt));
+            }
+            last->second = value;
+        }
+        for (const auto &[name, g] : gauges) {
+            const auto &keys = getKeys(name, "gauge", {""});
+            AddSample(keys[0], timestamp, std::to_string(g->Value()));
+        }
+        auto &snapshot = fHistogramSnapshot;
+        for (const auto &[name, h] : histograms) {
+            const auto &keys = getKeys(name, "histogram", {"p50", "p90", "p99", "max"});
+            h->Collect(snapshot);
+            if (snapshot.total > 0) {
+                for (auto q = 0u; q < Quantiles.size(); ++q) {
+                    AddSample(keys[q], timestamp, std::to_string(snapshot.Percentile(Quantiles[q])));
+                }
+                AddSample(keys[Quantiles.size()], timestamp, std::to_string(snapshot.max));
+            }
+        }
+    });
+}
+
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::SendHistogramMetrics(int64_t timestamp)
+{
+    static constexpr std::array<std::string_view, 4> Stats{"p50", "p90", "p99", "max"};
+    static constexpr std::array<double, 3> Quantiles{0.5, 0.9, 0.99};
+
+    auto &snapshot = fHistogramSnapshot;
+    for (const auto &[channelName, subChannels] : fChannelHistograms->GetAll()) {
+        for (auto i = 0u; i < subChannels.size(); ++i) {
+            const auto subChannelName = channelName + "[" + std::to_string(i) + "]";
+            auto itr = fTsHistKey.find(subChannelName);
+            if (itr == fTsHistKey.end()) {
+                std::vector<std::string> keys;
+                for (const auto &metric : {MessageSizePrefix, MessageGapPrefix}) {
+                    for (const auto &stat : Stats) {
+                        keys.push_back(join({"ts", fId, subChannelName, join({metric.data(), stat.data()}, "-")}, fSeparator));
+                    }
+                }
+                itr = fTsHistKey.emplace(subChannelName, std::move(keys)).first;
+            }
+            const auto &keys = itr->second;
+
+            if (fRegisteredTSKeys.count(keys.front())==0) {
+                // same labels as the socket metrics
+                std::unordered_map<std::string, std::string> labels;
+                if (auto p = fSocketProperties.find(subChannelName); p != fSocketProperties.end()) {
+                    labels = {{SocketName.data(),      p->second.name},
+                              {SocketType.data(),      p->second.type},
+                              {SocketTransport.data(), p->second.transport}};
+                }
+                for (const auto &k : keys) {
+                    auto l = labels;
+                    l.emplace(DataType.data(), k.substr(k.rfind(fSeparator) + fSeparator.size()));
+                    CreateTimeseries(k, l);
+                }
+            }
+
+            auto &h = *subChannels[i];
+            std::size_t offset = 0;
+            for (auto *histogram : {&h.size, &h.gap}) {
+                histogram->Collect(snapshot);
+                if (snapshot.total > 0) {
+                    // gap: nanoseconds -> microseconds
+                    const double scale = (histogram == &h.gap) ? 1e-3 : 1.0;
+                    for (auto q = 0u; q < Quantiles.size(); ++q) {
+                        AddSample(keys[offset + q], timestamp, std::to_string(snapshot.Percentile(Quantiles[q]) * scale));
+                    }
+                    AddSample(keys[offset + Quantiles.size()], timestamp, std::to_string(snapshot.max * scale));
+                }
+                offset += Stats.size();
+            }
+        }
+    }
+}
+
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::SendProcessMetrics()
+{
+    //std::cout << MyClass << " " << __FUNCTION__;
 
     auto nowProcSelfStat = ReadProcSelfStat();
     auto nowProcStat     = ReadProcStat();
@@ -694,19 +1920,47 @@ void daq::service::MetricsPlugin::SendProcessMetrics()
 
     const auto &[uptimeNSec, lastUpdate] = update_date(fCreatedTimeSystem, fCreatedTime);
     auto lastUpdateNS = std::chrono::duration_cast<std::chrono::nanoseconds>(lastUpdate.time_since_epoch());
+    const auto timestamp = to_msec(std::chrono::system_clock::now());
     try {
+        // the hashes are skipped while the server is unreachable (the samples go to the spool)
         if (fPipe) {
             fPipe->hset(fProcKey.cpu, {std::make_pair(fId, cpuUsage)})
             .hset(fProcKey.ram, {std::make_pair(fId, ramUsage)})
             .hset(fLastUpdateKey, fId, to_date(lastUpdate))
             .hset(fLastUpdateNSKey, fId, std::to_string(lastUpdateNS.count()))
-            .command("ts.add", fTsProcKey.cpu,        "*", std::to_string(cpuUsage))
-            .command("ts.add", fTsProcKey.ram,        "*", std::to_string(ramUsage))
-            .command("ts.add", fTsProcKey.stateId,    "*", std::to_string(stateId));
-            //std::cout << " "   << fTsProcKey.cpu       << "\t " << cpuUsage
-            //          << "\n " << fTsProcKey.ram       << "\t " << ramUsage
-            //          << "\n " << fTsProcKey.stateId   << "\t " << stateId << std::endl;
+            .zadd(fLastUpdateIndexKey, fId, static_cast<double>(timestamp));
+            Queued(5);
+        }
+        if (fRegisteredTSKeys.count(fTsProcKey.cpu)==0) {
+            // created at the first sample (in any state) and re-created after the deletion
+            // on the transition to Ready (recreate-ts=true)
+            CreateTimeseries(fTsProcKey.cpu,     {{DataType.data(), CpuStatPrefix.data()}});
+            CreateTimeseries(fTsProcKey.ram,     {{DataType.data(), RamStatPrefix.data()}});
+            CreateTimeseries(fTsProcKey.stateId, {{DataType.data(), StateIdPrefix.data()}});
+        }
+        AddSample(fTsProcKey.cpu,     timestamp, std::to_string(cpuUsage));
+        AddSample(fTsProcKey.ram,     timestamp, std::to_string(ramUsage));
+        AddSample(fTsProcKey.stateId, timestamp, std::to_string(stateId));
+        AddServiceSample("", CpuStatPrefix, timestamp, cpuUsage);
+        AddServiceSample("", RamStatPrefix, timestamp, ramUsage);
+        if (fChannelHistograms) {
+            SendHistogramMetrics(timestamp);
+        }
+        if (fChannelQueues) {
+            SendQueueMetrics(timestamp);
         }
+        if (fShmMetrics) {
+            SendShmMetrics(timestamp);
+        }
+        if (fThreadMetrics) {
+            SendThreadMetrics(timestamp, diffAll);
+        }
+        if (fIoMetrics) {
+            SendIoMetrics(timestamp, nowProcSelfStat);
+        }
+        //std::cout << " "   << fTsProcKey.cpu       << "\t " << cpuUsage
+        //          << "\n " << fTsProcKey.ram       << "\t " << ramUsage
+        //          << "\n " << fTsProcKey.stateId   << "\t " << stateId << std::endl;
     } catch (const std::exception& e) {
         std::cerr << MyClass << " " << __FUNCTION__ << " exception : what() " << e.what();
     } catch (...) {
@@ -716,7 +1970,78 @@ void daq::service::MetricsPlugin::SendProcessMetrics()
 }
 
 //_____________________________________________________________________________
-void daq::service::MetricsPlugin::SendSocketMetrics(const std::string &content)
+void daq::service::MetricsPlugin::SampleSocketMetrics()
+{
+    if (!fGetSocketCounters) {
+        return;
+    }
+    try {
+        const auto counters  = fGetSocketCounters();
+        const auto timestamp = to_msec(std::chrono::system_clock::now());
+        const auto now       = std::chrono::steady_clock::now();
+        const auto isFirst  = fSocketCountersLast.empty();
+        const double dt     = std::chrono::duration<double>(now - fSocketSampleTime).count();
+        fSocketSampleTime   = now;
+        if (isFirst || (dt <= 0)) {
+            fSocketCountersStart.insert(counters.cbegin(), counters.cend());
+            fSocketCountersLast.insert(counters.cbegin(), counters.cend());
+            return;
+        }
+
+        // counters are reset when the socket is recreated
+        auto diff = [](uint64_t a, uint64_t b) -> double {
+            return (a >= b) ? (a - b) : a;
+        };
+
+        for (const auto &[name, c] : counters) {
+            // name = <channel-name>[<sub-channel-index>]
+            const auto pos = name.find_last_of('[');
+            if ((pos==std::string::npos) || (name.back()!=']')) {
+                continue;
+            }
+            const auto itr = fSocketCountersLast.find(name);
+            if (itr == fSocketCountersLast.end()) {
+                fSocketCountersStart.emplace(name, c);
+                fSocketCountersLast.emplace(name, c);
+                continue;
+            }
+            auto &last        = itr->second;
+            const auto &start = fSocketCountersStart[name];
+
+            // rates in msg/s and MB/s (the same units as the rate log lines of FairMQ)
+            SocketMetrics rate;
+            rate.msgIn    = diff(c.msgIn,    last.msgIn)    / dt;
+            rate.msgOut   = diff(c.msgOut,   last.msgOut)   / dt;
+            rate.bytesIn  = diff(c.bytesIn,  last.bytesIn)  / 1e6 / dt;
+            rate.bytesOut = diff(c.bytesOut, last.bytesOut) / 1e6 / dt;
+
+            // totals since the beginning of Running state
+            SocketMetrics sum;
+            sum.msgIn    = diff(c.msgIn,    start.msgIn);
+            sum.msgOut   = diff(c.msgOut,   start.msgOut);
+            sum.bytesIn  = diff(c.bytesIn,  start.bytesIn)  / 1e6;
+            sum.bytesOut = diff(c.bytesOut, start.bytesOut) / 1e6;
+            last = c;
+
+            MetricRecord r;
+            r.type  = MetricRecord::Type::Socket;
+            r.key   = name.substr(0, pos);
+            r.field = name.substr(pos+1, name.size()-pos-2);
+            r.timestamp = timestamp;
+            r.now   = rate;
+            r.sum   = sum;
+            Push(std::move(r));
+        }
+        Push(MetricRecord{}); // flush
+    } catch (const std::exception &e) {
+        std::cerr << MyClass << " " << __FUNCTION__ << " exception : what() = " << e.what();
+    } catch (...) {
+        std::cerr << MyClass << " " << __FUNCTION__ << " exception : unknown";
+    }
+}
+
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::ParseSocketMetrics(const std::string &content, int64_t timestamp)
 {
     //LOG(debug) << MyClass << " " << __FUNCTION__;
     //return;
@@ -732,8 +2057,8 @@ void daq::service::MetricsPlugin::SendSocketMetrics(const std::string &content)
     // pattern :  _channel_[_index_]: in: _msg-in_ (_bytes-in_ MB) out: _msg-out_ (_bytes-out_ MB)
     // targets are surrounded by "()"
     // search results:
-    //               (1 )  (2  )        (3          )   (4          )           (5          )   (6          )
-    std::regex  r{R"((.*)\[(\d+)\]: in: ([\d.eE\-+]+) \(([\d.eE\-+]+) MB\) out: ([\d.eE\-+]+) \(([\d.eE\-+]+) MB\))"};
+    //                           (1 )  (2  )        (3          )   (4          )           (5          )   (6          )
+    static const std::regex r{R"((.*)\[(\d+)\]: in: ([\d.eE\-+]+) \(([\d.eE\-+]+) MB\) out: ([\d.eE\-+]+) \(([\d.eE\-+]+) MB\))"};
 
     std::smatch m;
     std::regex_search(content, m, r);
@@ -743,59 +2068,284 @@ void daq::service::MetricsPlugin::SendSocketMetrics(const std::string &content)
         return;
     }
 
-    auto channelName     = m[Channel].str();
-    boost::trim_if(channelName, boost::is_space());
-    auto subChannelIndex = m[SubChannelIndex].str();
-    boost::trim_if(subChannelIndex, boost::is_space());
-    auto subChannelName  = channelName + "[" + subChannelIndex + "]";
-    auto channelId       = join({fId, subChannelName}, fSeparator);
-    auto i=0;
+    MetricRecord rec;
+    rec.type  = MetricRecord::Type::SocketRate;
+    rec.timestamp = timestamp;
+    rec.key   = m[Channel].str();
+    boost::trim_if(rec.key, boost::is_space());
+    rec.field = m[SubChannelIndex].str();
+    boost::trim_if(rec.field, boost::is_space());
     //for (auto itr = m.begin(); itr!=m.end(); ++itr) {
     //  std::cout << __LINE__<< " " << itr->str() << " " << m[i++].str() << std::endl;
     //}
 
-    SocketMetrics now;
-    now.msgIn    = std::stod(m[NumMessageIn].str());
-    now.msgOut   = std::stod(m[NumMessageOut].str());
+    rec.now.msgIn    = std::stod(m[NumMessageIn].str());
+    rec.now.msgOut   = std::stod(m[NumMessageOut].str());
     // mega bytes
-    now.bytesIn  = std::stod(m[BytesIn].str());
-    now.bytesOut = std::stod(m[BytesOut].str());
+    rec.now.bytesIn  = std::stod(m[BytesIn].str());
+    rec.now.bytesOut = std::stod(m[BytesOut].str());
+
+    Push(std::move(rec));
+}
+
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::Publish(MetricRecord &r)
+{
+    try {
+        RecoverPipe();
+        switch (r.type) {
+        case MetricRecord::Type::Hash:
+            QueueHash(r.key, r.field, r.value);
+            break;
+        case MetricRecord::Type::Socket:
+            SendSocketMetrics(r.key, r.field, r.timestamp, r.now, r.sum);
+            break;
+        case MetricRecord::Type::SocketRate:
+        {
+            auto subChannelName = r.key + "[" + r.field + "]";
+            auto& sum = fSocketMetrics[subChannelName];
+            sum.msgIn    += r.now.msgIn;
+            sum.msgOut   += r.now.msgOut;
+            sum.bytesIn  += r.now.bytesIn;
+            sum.bytesOut += r.now.bytesOut;
+
+            //std::cout << __LINE__ << " " << subChannelName << " (sum) in = " << sum.msgIn << " " << sum.bytesIn << " MB, out = " << sum.msgOut << " " << sum.bytesOut << " MB" << std::endl;
+            SendSocketMetrics(r.key, r.field, r.timestamp, r.now, sum);
+
+            auto &count = fNumChannels[subChannelName];
+            if (count==0) {
+                ++count;
+            }
+            std::size_t countAll = 0;
+            for (const auto &[k, v] : fNumChannels) {
+                countAll += v;
+            }
+            if (countAll==fSocketMetrics.size()) {
+                Exec();
+                fNumChannels.clear();
+            }
+            break;
+        }
+        case MetricRecord::Type::Process:
+            SendProcessMetrics();
+            break;
+        case MetricRecord::Type::Custom:
+            if (fCustomMetrics) {
+                SendCustomMetrics(to_msec(std::chrono::system_clock::now()));
+            }
+            break;
+        case MetricRecord::Type::RunStart:
+            BeginRun();
+            break;
+        case MetricRecord::Type::RunStop:
+            EndRun();
+            break;
+        case MetricRecord::Type::Flush:
+            Exec();
+            break;
+        }
+    } catch (const std::exception &e) {
+        std::cerr << MyClass << " " << __FUNCTION__ << " exception : what() = " << e.what();
+    } catch (...) {
+        std::cerr << MyClass << " " << __FUNCTION__ << " exception : unknown";
+    }
+}
+
+//_____________________________________________________________________________
+bool daq::service::MetricsPlugin::Push(MetricRecord &&r)
+{
+    const auto isFlush = (r.type == MetricRecord::Type::Flush);
+    if (!fQueue->TryPush(std::move(r))) {
+        fNumDropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    if (isFlush) {
+        fPublisherCondition.notify_one();
+    }
+    return true;
+}
+
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::PushControl(MetricRecord &&r)
+{
+    // records of the state changes wait until the publisher thread makes room, but at most ControlPushTimeout,
+    // so that the state transition is not blocked by a stalled publisher. (TryPush() moves the record only when it succeeds)
+    const auto deadline = std::chrono::steady_clock::now() + ControlPushTimeout;
+    while (!fQueue->TryPush(std::move(r))) {
+        if (fPublisherStopRequested || (std::chrono::steady_clock::now() >= deadline)) {
+            fNumDropped.fetch_add(1, std::memory_order_relaxed);
+            LOG(error) << MyClass << " " << __FUNCTION__ << " metrics queue is full. "
+                       << ((r.type == MetricRecord::Type::RunStart) ? "RunStart" : "RunStop") << " record dropped";
+            return;
+        }
+        fPublisherCondition.notify_one();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    fPublisherCondition.notify_one();
+}
+
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::Queued(std::size_t n)
+{
+    if (fNumQueuedCommands==0) {
+        fOldestQueuedTime = std::chrono::steady_clock::now();
+    }
+    fNumQueuedCommands += n;
+}
+
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::RecoverPipe()
+{
+    if (fPipe) {
+        return;
+    }
+    if (!fBackendHealthy && !fSpoolThread.joinable()) {
+        // no spool: the publisher checks the recovery itself (at most once per retry interval)
+        const auto now = std::chrono::steady_clock::now();
+        if (now - fLastRecoveryCheck < std::chrono::milliseconds(fSpoolRetryInterval)) {
+            return;
+        }
+        fLastRecoveryCheck = now;
+        try {
+            fClient->ping();
+            LOG(info) << MyClass << " redis server is reachable again";
+            fBackendHealthy = true;
+        } catch (const sw::redis::Error &) {
+            return;
+        }
+    }
+    if (!fBackendHealthy) {
+        return;
+    }
+    fPipe = std::make_unique<sw::redis::Pipeline>(fClient->pipeline());
+    // one-shot writes kept during the outage
+    auto n = fPendingHashes.size()
+             + (fPendingDelKeys.empty() ? 0 : 1)
+             + (fPendingIndexFields.empty() ? 0 : 1)
+             + (fPendingTSKeys.empty() ? 0 : 1)
+             + (fPendingServiceKeys.empty() ? 0 : 1);
+    if (fRunLabelsPending) {
+        n += fRegisteredTSKeys.size() * (1 + fCompactionRules.size());
+    }
+    if (n>0) {
+        Queued(n);
+    }
+}
 
-    auto& sum = fSocketMetrics[subChannelName];
-    sum.msgIn    += now.msgIn;
-    sum.msgOut   += now.msgOut;
-    sum.bytesIn  += now.bytesIn;
-    sum.bytesOut += now.bytesOut;
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::SendFlush()
+{
+    // called by the publisher thread without fMutex, so that the state and property callbacks (threads of FairMQ)
+    // are not blocked by a slow or unreachable server. fPipe is used only by the publisher thread.
+    if (!fFlush.ready) {
+        return;
+    }
+    auto lost = false;
+    const auto t0 = std::chrono::steady_clock::now();
+    try {
+        fPipe->exec();
+    } catch (const sw::redis::ReplyError &e) {
+        // error reply of a command. the server is alive and has executed the other commands.
+        LOG(error) << MyClass << " " << __FUNCTION__ << " error reply : " << e.what();
+        try {
+            fPipe = std::make_unique<sw::redis::Pipeline>(fClient->pipeline());
+        } catch (const sw::redis::Error &) {
+            fPipe.reset();
+        }
+    } catch (const sw::redis::Error &e) {
+        // connection lost, timeout, ... the pipeline is not usable any more.
+        // it is re-created after the recovery, so that the samplers do not try to reconnect at every sample.
+        LOG(warn) << MyClass << " " << __FUNCTION__ << " redis server unreachable : " << e.what();
+        fPipe.reset();
+        lost = true;
+    }
+    fFlushLatency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0);
+
+    std::lock_guard<std::mutex> lock{fMutex};
+    if (!fPipe) {
+        fBackendHealthy = false;
+        fLastRecoveryCheck = std::chrono::steady_clock::now();
+        fSpoolCondition.notify_one();
+    }
+    if (!lost) {
+        // the one-shot writes have reached the server
+        fNumDroppedPublished = fFlush.nDropped;
+        fFlush = FlushBatch{};
+        return;
+    }
+    SpoolSamples(fFlush.samples);
+    // the series are created after the recovery (before the replay of the spool)
+    fPendingTSKeys.insert(fPendingTSKeys.end(), fFlush.tsKeys.cbegin(), fFlush.tsKeys.cend());
+    fPendingServiceKeys.insert(fPendingServiceKeys.end(), fFlush.serviceKeys.cbegin(), fFlush.serviceKeys.cend());
+    // fields updated in the meantime keep the newer value
+    for (auto &[key, fields] : fFlush.hashes) {
+        auto &pending = fPendingHashes[key];
+        for (auto &[field, value] : fields) {
+            pending.try_emplace(field, std::move(value));
+        }
+    }
+    fPendingDelKeys.insert(fPendingDelKeys.begin(), fFlush.delKeys.cbegin(), fFlush.delKeys.cend());
+    fPendingIndexFields.insert(fPendingIndexFields.end(), fFlush.indexFields.cbegin(), fFlush.indexFields.cend());
+    fRunLabelsPending |= fFlush.runLabels;
+    fFlush = FlushBatch{};
+}
+
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::SendSocketMetrics(const std::string &channelName,
+        const std::string &subChannelIndex,
+        int64_t timestamp,
+        const SocketMetrics &now,
+        const SocketMetrics &sum)
+{
+    auto subChannelName  = channelName + "[" + subChannelIndex + "]";
+    auto channelId       = join({fId, subChannelName}, fSeparator);
 
-    //std::cout << __LINE__ << " " << channelName << " (sum) in = " << sum.msgIn << " " << sum.bytesIn << " MB, out = " << sum.msgOut << " " << sum.bytesOut << " MB" << std::endl;
     auto msgIn     = static_cast<uint64_t>(std::nearbyint(now.msgIn));
     auto msgOut    = static_cast<uint64_t>(std::nearbyint(now.msgOut));
 
     auto msgInSum  = static_cast<uint64_t>(std::nearbyint(sum.msgIn));
     auto msgOutSum = static_cast<uint64_t>(std::nearbyint(sum.msgOut));
 
+    if (fRunning) {
+        auto &r = fRunSummary[subChannelName];
+        r.total = sum;
+        r.peak.msgIn    = std::max(r.peak.msgIn,    now.msgIn);
+        r.peak.msgOut   = std::max(r.peak.msgOut,   now.msgOut);
+        r.peak.bytesIn  = std::max(r.peak.bytesIn,  now.bytesIn);
+        r.peak.bytesOut = std::max(r.peak.bytesOut, now.bytesOut);
+    }
+
     try {
-        if (fPipe) {
-            const auto &socketTypeKey = join({"chans", channelName, subChannelIndex, "type"},  ".");
-            // std::cout << " channel type key = " << socketTypeKey << std::endl;
-            std::string socketType;
-            if (PropertyExists(socketTypeKey)) {
-                socketType = GetProperty<std::string>(socketTypeKey);
-            } else {
-                return;
-            }
-            bool hasInput  = (socketType!="push") && (socketType!="pub");
-            bool hasOutput = (socketType!="pull") && (socketType!="sub");
-            if (!hasInput && !hasOutput) {
-                return;
-            }
+        const auto &socketTypeKey = join({"chans", channelName, subChannelIndex, "type"},  ".");
+        // std::cout << " channel type key = " << socketTypeKey << std::endl;
+        std::string socketType;
+        if (PropertyExists(socketTypeKey)) {
+            socketType = GetProperty<std::string>(socketTypeKey);
+        } else {
+            return;
+        }
+        bool hasInput  = (socketType!="push") && (socketType!="pub");
+        bool hasOutput = (socketType!="pull") && (socketType!="sub");
+        if (!hasInput && !hasOutput) {
+            return;
+        }
 
-            // LOG(debug) << " subChannelName = " << subChannelName;
+        // LOG(debug) << " subChannelName = " << subChannelName;
 
-            const auto tsKey       = fTsSockKey[subChannelName];
-            const auto tsSumKey    = fTsSockSumKey[subChannelName];
+        const auto tsKey       = fTsSockKey[subChannelName];
+        const auto tsSumKey    = fTsSockSumKey[subChannelName];
 
-            if (hasInput) {
+        if (hasInput) {
+            const auto prefix = subChannelName + fSeparator;
+            if (fSocketFields.empty()) {
+                Queued((fMaxTtl>0) ? 2 : 1); // hset and pexpire of all fields in Exec()
+            }
+            fSocketFields.emplace_back(prefix + MessageInPrefix.data(), std::to_string(msgIn));
+            fSocketFields.emplace_back(prefix + BytesInPrefix.data(),   std::to_string(now.bytesIn));
+            fSocketFields.emplace_back(prefix + MessageInPrefix.data() + "-sum", std::to_string(msgInSum));
+            fSocketFields.emplace_back(prefix + BytesInPrefix.data()   + "-sum", std::to_string(sum.bytesIn));
+            if (fCompatKeys && fPipe) {
+                Queued(8);
                 fPipe->hset(fSockKey.msgIn,       {std::make_pair(channelId, msgIn)})
                 .hset(fSockKey.bytesIn,     {std::make_pair(channelId, now.bytesIn)})  // mega bytes
                 .hset(fSockSumKey.msgIn,    {std::make_pair(channelId, msgInSum)})
@@ -803,19 +2353,33 @@ void daq::service::MetricsPlugin::SendSocketMetrics(const std::string &content)
                 .hset(fNumMessageKey,       {std::make_pair(channelId+".in",  msgIn)})
                 .hset(fBytesKey,            {std::make_pair(channelId+".in",  now.bytesIn)})
                 .hset(fNumMessageSumKey,    {std::make_pair(channelId+".in",  msgInSum)})
-                .hset(fBytesSumKey,         {std::make_pair(channelId+".in",  sum.bytesIn)})
-                .command("ts.add", tsKey.msgIn,         "*", std::to_string(msgIn))
-                .command("ts.add", tsKey.bytesIn,       "*", std::to_string(now.bytesIn))
-                .command("ts.add", tsSumKey.msgIn,      "*", std::to_string(msgInSum))
-                .command("ts.add", tsSumKey.bytesIn,    "*", std::to_string(sum.bytesIn));
-                //std::cout << __LINE__ << " has input: "
-                //          << tsKey.msgIn       << "\t " << msgIn
-                //          << "\n " << tsKey.bytesIn     << "\t " << now.bytesIn
-                //          << "\n " << tsSumKey.msgIn    << "\t " << msgInSum
-                //          << "\n " << tsSumKey.bytesIn  << "\t " << sum.bytesIn << std::endl;
-            }
-
-            if (hasOutput) {
+                .hset(fBytesSumKey,         {std::make_pair(channelId+".in",  sum.bytesIn)});
+                for (const auto &key : {fSockKey.msgIn, fSockKey.bytesIn, fSockSumKey.msgIn, fSockSumKey.bytesIn}) {
+                    IndexField(key, channelId);
+                }
+                for (const auto &key : {fNumMessageKey, fBytesKey, fNumMessageSumKey, fBytesSumKey}) {
+                    IndexField(key, channelId+".in");
+                }
+            }
+            AddSample(tsKey.msgIn,      timestamp, std::to_string(msgIn));
+            AddSample(tsKey.bytesIn,    timestamp, std::to_string(now.bytesIn));
+            AddSample(tsSumKey.msgIn,   timestamp, std::to_string(msgInSum));
+            AddSample(tsSumKey.bytesIn, timestamp, std::to_string(sum.bytesIn));
+            AddServiceSample(channelName, MessageInPrefix, timestamp, now.msgIn);
+            AddServiceSample(channelName, BytesInPrefix,   timestamp, now.bytesIn);
+        }
+
+        if (hasOutput) {
+            const auto prefix = subChannelName + fSeparator;
+            if (fSocketFields.empty()) {
+                Queued((fMaxTtl>0) ? 2 : 1); // hset and pexpire of all fields in Exec()
+            }
+            fSocketFields.emplace_back(prefix + MessageOutPrefix.data(), std::to_string(msgOut));
+            fSocketFields.emplace_back(prefix + BytesOutPrefix.data(),   std::to_string(now.bytesOut));
+            fSocketFields.emplace_back(prefix + MessageOutPrefix.data() + "-sum", std::to_string(msgOutSum));
+            fSocketFields.emplace_back(prefix + BytesOutPrefix.data()   + "-sum", std::to_string(sum.bytesOut));
+            if (fCompatKeys && fPipe) {
+                Queued(8);
                 fPipe->hset(fSockKey.msgOut,      {std::make_pair(channelId, msgOut)})
                 .hset(fSockKey.bytesOut,    {std::make_pair(channelId, now.bytesOut)}) // mega bytes
                 .hset(fSockSumKey.msgOut,   {std::make_pair(channelId, msgOutSum)})
@@ -823,38 +2387,309 @@ void daq::service::MetricsPlugin::SendSocketMetrics(const std::string &content)
                 .hset(fNumMessageKey,       {std::make_pair(channelId+".out", msgOut)})
                 .hset(fBytesKey,            {std::make_pair(channelId+".out", now.bytesOut)})
                 .hset(fNumMessageSumKey,    {std::make_pair(channelId+".out", msgOutSum)})
-                .hset(fBytesSumKey,         {std::make_pair(channelId+".out", sum.bytesOut)})
-                .command("ts.add", tsKey.msgOut,         "*", std::to_string(msgOut))
-                .command("ts.add", tsKey.bytesOut,       "*", std::to_string(now.bytesOut))
-                .command("ts.add", tsSumKey.msgOut,      "*", std::to_string(msgOutSum))
-                .command("ts.add", tsSumKey.bytesOut,    "*", std::to_string(sum.bytesOut));
-                //std::cout << __LINE__ << " has output: "
-                //          << tsKey.msgOut      << "\t " << msgOut
-                //          << "\n " << tsKey.bytesOut    << "\t " << now.bytesOut
-                //          << "\n " << tsSumKey.msgOut   << "\t " << msgOutSum
-                //          << "\n " << tsSumKey.bytesOut << "\t " << sum.bytesOut << std::endl;
-
-            }
-
-            auto &count = fNumChannels[subChannelName];
-            if (count==0) {
-                ++count;
-            }
-            auto countAll = 0;
-            for (const auto &[k, v] : fNumChannels) {
-                countAll += v;
-            }
-            if (countAll==fSocketMetrics.size()) {
-                SendProcessMetrics();
-                fPipe->exec();
-                fNumChannels.clear();
+                .hset(fBytesSumKey,         {std::make_pair(channelId+".out", sum.bytesOut)});
+                for (const auto &key : {fSockKey.msgOut, fSockKey.bytesOut, fSockSumKey.msgOut, fSockSumKey.bytesOut}) {
+                    IndexField(key, channelId);
+                }
+                for (const auto &key : {fNumMessageKey, fBytesKey, fNumMessageSumKey, fBytesSumKey}) {
+                    IndexField(key, channelId+".out");
+                }
             }
-        } //else {
-        //std::cout << __LINE__ << " no pipeline is created " << std::endl;
-        //}
+            AddSample(tsKey.msgOut,      timestamp, std::to_string(msgOut));
+            AddSample(tsKey.bytesOut,    timestamp, std::to_string(now.bytesOut));
+            AddSample(tsSumKey.msgOut,   timestamp, std::to_string(msgOutSum));
+            AddSample(tsSumKey.bytesOut, timestamp, std::to_string(sum.bytesOut));
+            AddServiceSample(channelName, MessageOutPrefix, timestamp, now.msgOut);
+            AddServiceSample(channelName, BytesOutPrefix,   timestamp, now.bytesOut);
+        }
     } catch (const std::exception &e) {
         std::cerr << MyClass << " " << __FUNCTION__ << " exception : what() = " << e.what();
     } catch (...) {
         std::cerr << MyClass << " " << __FUNCTION__ << " exception : unknown";
     }
 }
+
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::SpoolSamples(const std::vector<std::string> &samples)
+{
+    // samples = "ts.madd" <key> <timestamp> <value> ...
+    uint64_t nLost = 0;
+    for (auto i = 1u; i + 2 < samples.size(); i += 3) {
+        // the per-service sums (DUPLICATE_POLICY SUM) are not spooled: a sample already applied by the server
+        // before the connection was lost would be added twice by the replay
+        if (!fSpool || (fRegisteredServiceKeys.count(samples[i])>0)
+                || !fSpool->Append(samples[i], std::stoll(samples[i+1]), samples[i+2])) {
+            ++nLost;
+        }
+    }
+    if (fSpool) {
+        const auto n = fSpool->NumDropped();
+        nLost += n - fNumSpoolDropped;
+        fNumSpoolDropped = n;
+    }
+    // published in the "dropped" hash after the recovery
+    fNumDropped.fetch_add(nLost, std::memory_order_relaxed);
+}
+
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::WriteRunSummary()
+{
+    // one compact JSON record per device and run: hset metrics:run-summary:<run_number> <id> <json>
+    const auto stopTime = std::chrono::system_clock::now();
+    const double duration = std::chrono::duration<double>(stopTime - fRunStartTime).count();
+    const double cpuSec   = static_cast<double>(ReadProcSelfStat().sum() - fRunStartCpuTicks) / fClockTick;
+
+    // property_tree escapes the run number and the channel names (values are written as strings)
+    boost::property_tree::ptree obj;
+    obj.put("run_number", fRunNumber);
+    obj.put("start",      to_msec(fRunStartTime));
+    obj.put("stop",       to_msec(stopTime));
+    obj.put("duration-s", duration);
+    obj.put("cpu-s",      cpuSec);
+    boost::property_tree::ptree channels;
+    for (const auto &[name, r] : fRunSummary) {
+        auto mean = [duration](double total) {
+            return (duration > 0) ? total / duration : 0.0;
+        };
+        boost::property_tree::ptree c;
+        c.put("msg-in",       static_cast<uint64_t>(std::nearbyint(r.total.msgIn)));
+        c.put("msg-out",      static_cast<uint64_t>(std::nearbyint(r.total.msgOut)));
+        c.put("mb-in",        r.total.bytesIn);
+        c.put("mb-out",       r.total.bytesOut);
+        c.put("mean-msg-in",  mean(r.total.msgIn));
+        c.put("mean-msg-out", mean(r.total.msgOut));
+        c.put("mean-mb-in",   mean(r.total.bytesIn));
+        c.put("mean-mb-out",  mean(r.total.bytesOut));
+        c.put("peak-msg-in",  r.peak.msgIn);
+        c.put("peak-msg-out", r.peak.msgOut);
+        c.put("peak-mb-in",   r.peak.bytesIn);
+        c.put("peak-mb-out",  r.peak.bytesOut);
+        // push_back: the channel name is not parsed as a path ('.' separated)
+        channels.push_back({name, c});
+    }
+    obj.add_child("channels", channels);
+    auto json = to_string(obj, false);
+    boost::trim_right(json); // write_json() ends with a new line
+
+    const auto key = fRunNumber.empty() ? fRunSummaryKey : join({fRunSummaryKey, fRunNumber}, fSeparator);
+    LOG(debug) << MyClass << " run summary: " << key << " " << json;
+    QueueHash(key, fId, json);
+    Push(MetricRecord{}); // flush
+}
+
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::StartContext()
+{
+    if (fContext) {
+        return;
+    }
+    // create io_context, work_guard (to avoid exit of io_context::run())
+    fContext   = std::make_shared<net::io_context>();
+    fWorkGuard = std::make_unique<work_guard_t>(net::make_work_guard(*fContext));
+    // start io_context::run() in another thread
+    fTimerThread = std::thread([this]() {
+        fContext->run();
+    });
+}
+
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::StartExporters()
+{
+    using opt = OptionKey;
+    std::vector<std::string> names;
+    auto value = GetProperty<std::string>(opt::Exporter.data());
+    boost::to_lower(value);
+    boost::split(names, value, boost::is_any_of(", "), boost::token_compress_on);
+
+    fTsRedis = false;
+    for (const auto &name : names) {
+        try {
+            if (name=="redis") {
+                fTsRedis = true;
+            } else if (name=="prometheus") {
+                StartContext();
+                auto e = std::make_unique<PrometheusExporter>(fContext, GetProperty<std::string>("host-ip"),
+                         GetProperty<unsigned short>(opt::PrometheusPort.data()));
+                fPrometheusPort = e->Port();
+                fExporters.push_back(std::move(e));
+            } else if (name=="shm") {
+                fExporters.push_back(std::make_unique<ShmTableExporter>(fId, GetProperty<unsigned int>(opt::ShmTableSize.data())));
+            } else if (name=="otlp") {
+#ifdef WITH_OTEL_CPP
+                fExporters.push_back(std::make_unique<OtlpExporter>(GetProperty<std::string>(opt::OtlpEndpoint.data()),
+                                     fServiceName, fId,
+                                     GetProperty<long long>(opt::OtlpExportInterval.data())));
+#else
+                LOG(error) << MyClass << " otlp exporter is not available. (build with -DWITH_OTEL_CPP=ON)";
+#endif
+            } else if (!name.empty()) {
+                LOG(error) << MyClass << " unknown metrics exporter: " << name;
+            }
+        } catch (const std::exception &e) {
+            LOG(error) << MyClass << " failed to start metrics exporter " << name << " : " << e.what();
+        }
+    }
+}
+
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::StartPublisher()
+{
+    using opt = OptionKey;
+    fQueue = std::make_unique<MetricsQueue<MetricRecord>>(GetProperty<std::size_t>(opt::QueueSize.data()));
+    LOG(debug) << MyClass << " metrics queue capacity = " << fQueue->Capacity();
+
+    // wake up at least once per max age to flush an idle pipeline
+    const auto waitTime = std::chrono::milliseconds((fFlushMaxAge>0) ? std::min(fFlushMaxAge, 100LL) : 100LL);
+    fPublisherThread = std::thread([this, waitTime]() {
+        MetricRecord r;
+        while (!fPublisherStopRequested) {
+            if (!fQueue->TryPop(r)) {
+                // producers wake up this thread only after a flush request.
+                {
+                    std::unique_lock<std::mutex> lock{fPublisherMutex};
+                    fPublisherCondition.wait_for(lock, waitTime);
+                }
+                {
+                    std::lock_guard<std::mutex> lock{fMutex};
+                    FlushIfDue();
+                }
+                SendFlush();
+                continue;
+            }
+            // the round trip to the server (SendFlush()) is made after fMutex is released
+            do {
+                {
+                    std::lock_guard<std::mutex> lock{fMutex};
+                    Publish(r);
+                    FlushIfDue();
+                }
+                SendFlush();
+            } while (fQueue->TryPop(r));
+        }
+    });
+}
+
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::StartSamplers()
+{
+    // each sampler has its own cadence. the samplers only read the counters and
+    // hand the records to the publisher thread, so they do not delay each other.
+    if (fUpdateInterval>0) {
+        LOG(debug) << MyClass << " process metrics: every " << fUpdateInterval << " msec";
+        StartContext();
+        auto t = std::make_unique<PeriodicTimer>();
+        t->Start(fContext, static_cast<unsigned int>(fUpdateInterval), [this]() {
+            MetricRecord r;
+            r.type = MetricRecord::Type::Process;
+            Push(std::move(r));
+            Push(MetricRecord{}); // flush
+        });
+        fSamplers.push_back(std::move(t));
+    }
+    if (fCustomInterval>0) {
+        LOG(debug) << MyClass << " custom metrics: every " << fCustomInterval << " msec";
+        StartContext();
+        auto t = std::make_unique<PeriodicTimer>();
+        t->Start(fContext, static_cast<unsigned int>(fCustomInterval), [this]() {
+            MetricRecord r;
+            r.type = MetricRecord::Type::Custom;
+            Push(std::move(r));
+            Push(MetricRecord{}); // flush
+        });
+        fSamplers.push_back(std::move(t));
+    }
+    if (fSampleSockets && (fSocketSampleInterval>0)) {
+        LOG(debug) << MyClass << " socket metrics: sample channel sockets every " << fSocketSampleInterval << " msec";
+        StartContext();
+        fSocketSampleTime = std::chrono::steady_clock::now();
+        auto t = std::make_unique<PeriodicTimer>();
+        t->Start(fContext, static_cast<unsigned int>(fSocketSampleInterval), [this]() {
+            std::lock_guard<std::mutex> lock{fSampleMutex};
+            SampleSocketMetrics();
+        });
+        fSamplers.push_back(std::move(t));
+    }
+}
+
+//_____________________________________________________________________________
+void daq::service::MetricsPlugin::StartSpool()
+{
+    using opt = OptionKey;
+    fSpoolRetryInterval = GetProperty<long long>(opt::SpoolRetryInterval.data());
+    fSpoolReplayBatch   = std::max<std::size_t>(1, GetProperty<std::size_t>(opt::SpoolReplayBatch.data()));
+    const auto dir = GetProperty<std::string>(opt::SpoolDir.data());
+    if (fTsRedis && !dir.empty()) {
+        try {
+            fSpool = std::make_unique<MetricsSpool>(dir, fId,
+                                                    GetProperty<std::size_t>(opt::SpoolSegmentSize.data()) * 1024 * 1024,
+                                                    GetProperty<std::size_t>(opt::SpoolMaxSize.data()) * 1024 * 1024);
+            LOG(debug) << MyClass << " metrics spool: " << dir;
+        } catch (const std::exception &e) {
+            LOG(error) << MyClass << " failed to open metrics spool " << dir << " : " << e.what();
+        }
+    }
+
+    if (!fSpool) {
+        // the publisher checks the recovery of the server (see RecoverPipe())
+        return;
+    }
+    // check the recovery of the server and replay the spool (also the samples left by a previous process).
+    // the publisher thread is not blocked. the ping and the creation script borrow a pooled connection for one
+    // command, the replay opens its own connection (held for the whole replay loop, so it must not hold one of the
+    // pool shared with the heartbeat of the daq_service plugin and TopologyConfig, whose wait_timeout is 0).
+    fSpoolThread = std::thread([this]() {
+        const auto waitTime = std::chrono::milliseconds(std::max(fSpoolRetryInterval, 1LL));
+        std::vector<MetricsSpool::Record> records;
+        std::vector<std::string> cmd;
+        while (!fSpoolStopRequested) {
+            {
+                std::unique_lock<std::mutex> lock{fSpoolMutex};
+                fSpoolCondition.wait_for(lock, waitTime);
+            }
+            if (fSpoolStopRequested) {
+                break;
+            }
+            if (!fBackendHealthy) {
+                try {
+                    fClient->ping();
+                    // the series pending at the outage are created before the replay and before the publisher
+                    // re-creates its pipeline
+                    CreatePendingTimeseries();
+                    LOG(info) << MyClass << " redis server is reachable again";
+                    fBackendHealthy = true;
+                } catch (const sw::redis::Error &) {
+                    continue;
+                }
+            }
+            if (!fBackendHealthy || (fSpool->Peek(records, fSpoolReplayBatch) == 0)) {
+                continue;
+            }
+            try {
+                // new connection (closed at the end of the replay)
+                auto pipe = fClient->pipeline(true);
+                while (!fSpoolStopRequested && fBackendHealthy && (fSpool->Peek(records, fSpoolReplayBatch) > 0)) {
+                    // samples already written before a lost reply are rejected one by one (error elements of the reply)
+                    // by the default duplicate policy (BLOCK) of the per-instance series. the per-service sums are
+                    // not in the spool.
+                    cmd.clear();
+                    cmd.emplace_back("ts.madd");
+                    for (const auto &r : records) {
+                        cmd.push_back(r.key);
+                        cmd.push_back(std::to_string(r.timestamp));
+                        cmd.push_back(r.value);
+                    }
+                    pipe.command(cmd.cbegin(), cmd.cend()).exec();
+                    fSpool->Pop();
+                    LOG(debug) << MyClass << " replayed " << records.size() << " samples from spool";
+                }
+            } catch (const sw::redis::ReplyError &e) {
+                LOG(error) << MyClass << " replay of spool : " << e.what() << ", n dropped = " << records.size();
+                fSpool->Pop();
+                fNumDropped.fetch_add(records.size(), std::memory_order_relaxed);
+            } catch (const sw::redis::Error &e) {
+                LOG(warn) << MyClass << " replay of spool : " << e.what();
+                fBackendHealthy = false;
+            }
+        }
+    });
+}
@@ -1,21 +1,33 @@
 #ifndef DaqService_Plugins_MetricsPlugin_h
 #define DaqService_Plugins_MetricsPlugin_h
 
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <cstdint>
 #include <deque>
-#include <fstream>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include <boost/asio.hpp>
 
 #include <fairmq/Plugin.h>
 
+#include "plugins/ChannelHistogram.h"
+#include "plugins/ChannelQueue.h"
+#include "plugins/CustomMetrics.h"
+#include "plugins/MetricsExporter.h"
+#include "plugins/MetricsQueue.h"
+#include "plugins/MetricsSpool.h"
+#include "plugins/ProcFile.h"
+#include "plugins/SocketCounters.h"
 #include "plugins/Timer.h"
 #include "plugins/TopologyData.h"
 
@@ -34,6 +46,9 @@ static constexpr std::string_view StatePrefix{"state"};
 static constexpr std::string_view StateIdPrefix{"state-id"};
 static constexpr std::string_view CpuStatPrefix{"cpu-stat"};
 static constexpr std::string_view RamStatPrefix{"ram-stat"};
+static constexpr std::string_view ShmUsedPrefix{"shm-used"};
+static constexpr std::string_view ShmFreePrefix{"shm-free"};
+static constexpr std::string_view ShmRegionsPrefix{"shm-regions"};
 
 static constexpr std::string_view MessageInPrefix{"msg-in"};
 static constexpr std::string_view BytesInPrefix{"mb-in"};
@@ -45,9 +60,53 @@ static constexpr std::string_view BytesPrefix{"mb"};
 static constexpr std::string_view NumMessageSumPrefix{"num-msg-sum"};
 static constexpr std::string_view BytesSumPrefix{"mb-sum"};
 
+static constexpr std::string_view MessageSizePrefix{"size"};
+static constexpr std::string_view MessageGapPrefix{"gap-us"};
+
+// channel queues (see plugins/ChannelQueue.h): the depth and high-water mark are 0 or sndBufSize,
+// and recv-wait is 0 for the devices which receive with OnData() callbacks (not measured)
+static constexpr std::string_view QueueDepthPrefix{"queue-depth"};
+static constexpr std::string_view QueueHighWaterPrefix{"queue-hwm"};
+static constexpr std::string_view QueueFullPrefix{"queue-full"};
+static constexpr std::string_view SendBlockedPrefix{"send-blocked"};
+static constexpr std::string_view RecvWaitPrefix{"recv-wait"};
+
+static constexpr std::string_view CustomPrefix{"custom"};
+static constexpr std::string_view RunSummaryPrefix{"run-summary"};
+static constexpr std::string_view ServiceAggregatePrefix{"service"};
+
 static constexpr std::string_view CreatedTimePrefix{"created-time"};
 static constexpr std::string_view LastUpdatePrefix{"last-update"};
 static constexpr std::string_view LastUpdateNSPrefix{"last-update-ns"};
+static constexpr std::string_view LastUpdateIndexPrefix{"last-update-index"};
+static constexpr std::string_view FieldIndexPrefix{"fields"};
+
+static constexpr std::string_view DroppedPrefix{"dropped"};
+static constexpr std::string_view SocketPrefix{"socket"};
+static constexpr std::string_view QueuedCommandsPrefix{"queued-commands"};
+static constexpr std::string_view FlushLatencyPrefix{"flush-latency-us"};
+static constexpr std::string_view PrometheusPortPrefix{"prometheus-port"};
+
+static constexpr std::string_view ThreadPrefix{"thread"};
+static constexpr std::string_view ThreadCpuPrefix{"thread-cpu"};
+static constexpr std::string_view ThreadCtxVoluntaryPrefix{"thread-ctxsw-vol"};
+static constexpr std::string_view ThreadCtxNonvoluntaryPrefix{"thread-ctxsw-nonvol"};
+static constexpr std::string_view ThreadRunDelayPrefix{"thread-run-delay"};
+
+static constexpr std::string_view NicRxBytesPrefix{"nic-rx-mb"};
+static constexpr std::string_view NicTxBytesPrefix{"nic-tx-mb"};
+static constexpr std::string_view NicRxPacketsPrefix{"nic-rx-pkt"};
+static constexpr std::string_view NicTxPacketsPrefix{"nic-tx-pkt"};
+static constexpr std::string_view NicRxDropPrefix{"nic-rx-drop"};
+static constexpr std::string_view NicTxDropPrefix{"nic-tx-drop"};
+static constexpr std::string_view NicRxErrorPrefix{"nic-rx-err"};
+static constexpr std::string_view NicTxErrorPrefix{"nic-tx-err"};
+static constexpr std::string_view NicRxUtilPrefix{"nic-rx-util"};
+static constexpr std::string_view NicTxUtilPrefix{"nic-tx-util"};
+static constexpr std::string_view IoReadPrefix{"io-read-mb"};
+static constexpr std::string_view IoWritePrefix{"io-write-mb"};
+static constexpr std::string_view MinorFaultPrefix{"page-fault-minor"};
+static constexpr std::string_view MajorFaultPrefix{"page-fault-major"};
 
 static constexpr std::string_view HostnamePrefix{"hostname"};
 static constexpr std::string_view HostIpAddressPrefix{"host-ip"};
@@ -58,6 +117,12 @@ static constexpr std::string_view SocketName{"name"};
 static constexpr std::string_view SocketType{"socket"};
 static constexpr std::string_view SocketTransport{"transport"};
 static constexpr std::string_view SocketMethod{"method"};
+static constexpr std::string_view ThreadName{"thread"};
+static constexpr std::string_view ThreadId{"tid"};
+static constexpr std::string_view NetworkInterface{"nic"};
+static constexpr std::string_view CustomKind{"kind"};
+static constexpr std::string_view Compaction{"compaction"};
+static constexpr std::string_view Aggregate{"aggregate"};
 
 struct ProcStat_t {
     uint64_t user{0};
@@ -74,6 +139,36 @@ struct ProcSelfStat_t {
     uint64_t stime{0};
     uint64_t vsize{0};
     uint64_t rss{0};
+    uint64_t minflt{0}; // minor page faults
+    uint64_t majflt{0}; // major page faults
+    inline uint64_t sum() {
+        return utime + stime;
+    }
+};
+
+// /proc/net/dev (network interface of the device), /proc/self/io and page faults of /proc/self/stat
+struct IoStat_t {
+    uint64_t rxBytes{0};
+    uint64_t rxPackets{0};
+    uint64_t rxErrors{0};
+    uint64_t rxDropped{0};
+    uint64_t txBytes{0};
+    uint64_t txPackets{0};
+    uint64_t txErrors{0};
+    uint64_t txDropped{0};
+    uint64_t readBytes{0};  // bytes fetched from the storage layer
+    uint64_t writeBytes{0}; // bytes sent to the storage layer
+    uint64_t minflt{0};
+    uint64_t majflt{0};
+};
+
+// /proc/self/task/<tid>/{stat,status,schedstat}
+struct ThreadStat_t {
+    uint64_t utime{0};
+    uint64_t stime{0};
+    uint64_t voluntary{0};    // voluntary context switches
+    uint64_t nonvoluntary{0}; // nonvoluntary context switches
+    uint64_t runDelay{0};     // time spent waiting on a run queue in nanoseconds
     inline uint64_t sum() {
         return utime + stime;
     }
@@ -86,12 +181,75 @@ struct SocketMetrics {
     double bytesOut{0};
 };
 
+// totals and peak rates of a sub-channel in a run
+struct RunSummary {
+    SocketMetrics total; // messages and MB since the beginning of the run
+    SocketMetrics peak;  // max of msg/s and MB/s
+};
+
+// record handed over from the producers (log sink, timer, callbacks) to the publisher thread
+struct MetricRecord {
+    enum class Type : uint8_t {
+        Hash,       // hset <key> <field> <value>
+        Socket,     // socket metrics (rate and sum)
+        SocketRate, // socket metrics from a rate log line (rate only)
+        Process,    // cpu and memory usage
+        Custom,     // custom metrics of the device
+        RunStart,   // series of the run (state Running)
+        RunStop,    // run summary and deletion of the series (state Ready)
+        Flush,      // execute the pipeline
+    };
+    Type type{Type::Flush};
+    std::string key;   // Hash: key, Socket: channel name
+    std::string field; // Hash: field, Socket: sub-channel index
+    std::string value; // Hash: value
+    int64_t timestamp{0}; // milliseconds since epoch at sampling time
+    SocketMetrics now;
+    SocketMetrics sum;
+};
+
 struct ProcessStatKey {
     std::string cpu;
     std::string ram;
     std::string stateId;
 };
 
+struct ShmStatKey {
+    std::string used;
+    std::string free;
+    std::string regions;
+};
+
+// server-side downsampling (ts.createrule <key> <key><suffix> aggregation <aggregator> <bucket>)
+struct CompactionRule {
+    std::string aggregator; // avg, sum, max, ...
+    std::string bucket;     // milliseconds
+    std::string name;       // e.g. avg-10s (label "compaction" and key suffix)
+};
+
+// per-service sum: the samples of this instance in the current bucket (averaged, so that
+// one value per bucket and instance is added to the shared series)
+struct ServiceSeries {
+    std::string key;
+    int64_t bucket{-1}; // start of the bucket in msec since epoch
+    double sum{0};
+    uint64_t n{0};
+};
+
+// writes of one flush: prepared by Exec() under the lock of the plugin and sent by SendFlush() without it.
+// restored as pending writes if the server is unreachable
+struct FlushBatch {
+    bool ready{false};
+    uint64_t nDropped{0};
+    std::vector<std::string> samples; // "ts.madd" <key> <timestamp> <value> ...
+    std::vector<std::string> tsKeys;
+    std::vector<std::string> serviceKeys;
+    std::map<std::string, std::map<std::string, std::string>> hashes;
+    std::vector<std::string> delKeys;
+    std::vector<std::string> indexFields;
+    bool runLabels{false};
+};
+
 struct SocketMetricsKey {
     std::string msgIn;
     std::string msgOut;
@@ -99,6 +257,25 @@ struct SocketMetricsKey {
     std::string bytesOut;
 };
 
+struct ThreadStatKey {
+    std::string cpu;
+    std::string ctxVoluntary;
+    std::string ctxNonvoluntary;
+    std::string runDelay;
+};
+
+struct ThreadEntry {
+    std::string name;
+    ProcFile stat;
+    ProcFile status;
+    ProcFile schedstat;
+    ThreadStat_t last;
+    ThreadStatKey tsKey;
+    uint64_t generation{0};
+};
+
+class RedisConnections;
+
 class MetricsPlugin : public fair::mq::Plugin
 {
 public:
@@ -110,6 +287,31 @@ public:
         static constexpr std::string_view Retention{"retention"};
         static constexpr std::string_view RecreateTS{"recreate-ts"};
         static constexpr std::string_view MaxTtl{"metrics-max-ttl"};
+        static constexpr std::string_view MigrateIndex{"metrics-migrate-index"};
+        static constexpr std::string_view SocketMetricsMode{"socket-metrics-mode"};
+        static constexpr std::string_view SocketSampleInterval{"socket-sample-interval"};
+        static constexpr std::string_view QueueSize{"metrics-queue-size"};
+        static constexpr std::string_view TsMadd{"ts-madd"};
+        static constexpr std::string_view CompatKeys{"metrics-compat-keys"};
+        static constexpr std::string_view FlushMaxCommands{"metrics-flush-max-commands"};
+        static constexpr std::string_view FlushMaxAge{"metrics-flush-max-age"};
+        static constexpr std::string_view ThreadMetrics{"thread-metrics"};
+        static constexpr std::string_view IoMetrics{"io-metrics"};
+        static constexpr std::string_view Exporter{"metrics-exporter"};
+        static constexpr std::string_view PrometheusPort{"prometheus-port"};
+        static constexpr std::string_view OtlpEndpoint{"otlp-endpoint"};
+        static constexpr std::string_view OtlpExportInterval{"otlp-export-interval"};
+        static constexpr std::string_view ShmTableSize{"metrics-shm-table-size"};
+        static constexpr std::string_view CustomInterval{"custom-metrics-interval"};
+        static constexpr std::string_view SpoolDir{"metrics-spool-dir"};
+        static constexpr std::string_view SpoolSegmentSize{"metrics-spool-segment-size"};
+        static constexpr std::string_view SpoolMaxSize{"metrics-spool-max-size"};
+        static constexpr std::string_view SpoolRetryInterval{"metrics-spool-retry-interval"};
+        static constexpr std::string_view SpoolReplayBatch{"metrics-spool-replay-batch"};
+        static constexpr std::string_view Compaction{"ts-compaction"};
+        static constexpr std::string_view CompactionRetention{"ts-compaction-retention"};
+        static constexpr std::string_view ServiceAggregate{"ts-service-aggregate"};
+        static constexpr std::string_view ServiceAggregateBucket{"ts-service-aggregate-bucket"};
     };
 
     MetricsPlugin(std::string_view name,
@@ -122,6 +324,10 @@ public:
     ~MetricsPlugin() override;
 
 private:
+    void AddSample(const std::string &key, int64_t timestamp, const std::string &value);
+    void AddServiceSample(const std::string &name, std::string_view metric, int64_t timestamp, double value);
+    void BeginRun();
+    void CreatePendingTimeseries();
     bool CreateSocketTS(std::string_view keyMsg,
                         std::string_view keyBytes,
                         std::string_view labelMsg,
@@ -130,49 +336,175 @@ private:
     bool CreateSocketTS();
     bool CreateTimeseries(std::string_view key,
                           const std::unordered_map<std::string, std::string> &labels);
+    std::vector<std::string> CreateTimeseriesArgs(const std::vector<std::string> &keys,
+                                                  std::string_view mode,
+                                                  std::string_view duplicatePolicy);
     void DeleteExpiredFields();
     void DeleteTSKeys();
+    void EndRun();
+    void Exec();
+    void FlushIfDue();
+    void IndexField(const std::string &key, const std::string &field);
+    void InitializeShmMetrics();
     void InitializeSocketProperties();
     bool IsRecreateTS();
+    void MigrateFieldIndex();
+    void ParseSocketMetrics(const std::string &content, int64_t timestamp);
+    void Publish(MetricRecord &r);
+    bool Push(MetricRecord &&r);
+    void PushControl(MetricRecord &&r);
+    void QueueCreateTimeseries(const std::vector<std::string> &keys, std::string_view mode, std::string_view duplicatePolicy);
+    void QueueHash(const std::string &key, const std::string &field, const std::string &value);
+    void QueueRunLabels(const std::vector<std::string> &createdKeys);
+    void Queued(std::size_t n = 1);
+    IoStat_t       ReadIoStat(const ProcSelfStat_t &procSelfStat);
     ProcSelfStat_t ReadProcSelfStat();
     ProcStat_t     ReadProcStat();
+    ThreadStat_t   ReadThreadStat(ThreadEntry &t);
+    void RecoverPipe();
+    void SampleSocketMetrics();
+    void SendCustomMetrics(int64_t timestamp);
+    void SendFlush();
+    void SendHistogramMetrics(int64_t timestamp);
+    void SendIoMetrics(int64_t timestamp, const ProcSelfStat_t &procSelfStat);
     void SendProcessMetrics();
-    void SendSocketMetrics(const std::string &content);
+    void SendQueueMetrics(int64_t timestamp);
+    void SendShmMetrics(int64_t timestamp);
+    void SendSocketMetrics(const std::string &channelName,
+                           const std::string &subChannelIndex,
+                           int64_t timestamp,
+                           const SocketMetrics &now,
+                           const SocketMetrics &sum);
+    void SendThreadMetrics(int64_t timestamp, uint64_t diffAll);
+    void SpoolSamples(const std::vector<std::string> &samples);
+    void StartContext();
+    void StartExporters();
+    void StartPublisher();
+    void StartSamplers();
+    void StartSpool();
+    void UpdateRunLabels();
+    void WriteRunSummary();
 
     //pid_t fPid;
     std::string fId;
     std::unordered_map<std::string, SocketMetrics> fSocketMetrics;
-    std::ifstream fProcStatFile;
-    std::ifstream fProcSelfStatFile;
+    ProcFile fProcStatFile;
+    ProcFile fProcSelfStatFile;
     ProcStat_t     fProcStat;
     ProcSelfStat_t fProcSelfStat;
     unsigned int fNCpuCores;
     long fClockTick;
     long fPageSize;
 
+    // usage of the shared memory segment (only with the shmem transport)
+    bool fShmMetrics{false};
+    std::string fShmSession;
+    std::string fShmId;
+    uint16_t fShmSegmentId{0};
+    std::size_t fShmSegmentSize{0};
+
+    // per-thread metrics (key = tid)
+    bool fThreadMetrics{false};
+    uint64_t fThreadGeneration{0};
+    std::unordered_map<int, ThreadEntry> fThreads;
+
+    // NIC and storage I/O of the process
+    bool fIoMetrics{false};
+    bool fIoInitialized{false};
+    std::string fNic;
+    double fNicSpeed{0}; // link speed in Mb/s from sysfs (0 if unknown)
+    ProcFile fProcNetDevFile;
+    ProcFile fProcSelfIoFile;
+    std::vector<char> fNetDevBuffer; // /proc/net/dev may be larger than ProcFile::BufferSize
+    IoStat_t fIoStat;
+    std::chrono::steady_clock::time_point fIoSampleTime;
+    std::vector<std::string> fTsIoKey; // same order as the metrics in SendIoMetrics()
+
     std::unique_ptr<work_guard_t> fWorkGuard;
     std::shared_ptr<net::io_context> fContext;
-    std::unique_ptr<Timer> fTimer;
     std::thread fTimerThread;
+    // periodic samplers on fContext (process metrics, socket counters, custom metrics)
+    std::vector<std::unique_ptr<PeriodicTimer>> fSamplers;
 
     // milliseconds
     long long fUpdateInterval{1000};
+    long long fCustomInterval{1000};
     long long fMaxTtl;
 
+    // socket metrics from the channel sockets (instead of the rate log lines)
+    bool fSampleSockets{false};
+    long long fSocketSampleInterval{1000};
+    std::mutex fSampleMutex;
+    SocketCountersFunction_t fGetSocketCounters;
+    std::unordered_map<std::string, SocketCounters> fSocketCountersStart;
+    std::unordered_map<std::string, SocketCounters> fSocketCountersLast;
+    std::chrono::steady_clock::time_point fSocketSampleTime;
+
     std::string fStartTimeKey;
     std::string fStartTimeNSKey;
     std::string fStopTimeKey;
     std::string fStopTimeNSKey;
     std::string fRunNumberKey;
 
+    // run-scoped series and summary
+    std::string fRunNumber; // value of the label "run_number"
+    std::string fRunSummaryKey;
+    bool fRunning{false};
+    std::chrono::system_clock::time_point fRunStartTime;
+    uint64_t fRunStartCpuTicks{0};
+    // key = <channel-name>[<sub-channel-index>]
+    std::unordered_map<std::string, RunSummary> fRunSummary;
+
     std::chrono::system_clock::time_point fCreatedTimeSystem;
     std::chrono::steady_clock::time_point fCreatedTime;
     std::string fCreatedTimeKey;
     std::string fHostNameKey;
     std::string fIpAddressKey;
+    // bound port of the Prometheus endpoint (0 = not used)
+    std::string fPrometheusPortKey;
+    unsigned short fPrometheusPort{0};
+
+    // hand-off queue to the publisher thread (the only writer of fPipe while running)
+    std::unique_ptr<MetricsQueue<MetricRecord>> fQueue;
+    std::atomic<uint64_t> fNumDropped{0};
+    uint64_t fNumDroppedPublished{0};
+    std::atomic<bool> fPublisherStopRequested{false};
+    std::mutex fPublisherMutex;
+    std::condition_variable fPublisherCondition;
+    std::thread fPublisherThread;
+
+    // the pipeline is executed at the latest when one of the limits is reached
+    std::size_t fFlushMaxCommands{1024};
+    long long fFlushMaxAge{1000}; // milliseconds
+    std::size_t fNumQueuedCommands{0};
+    std::chrono::steady_clock::time_point fOldestQueuedTime;
+    std::chrono::microseconds fFlushLatency{0};
+
+    // while the Redis server is unreachable, samples of time series are written to the spool
+    // and the replay thread sends them after the recovery. the publisher does not wait for Redis.
+    std::atomic<bool> fBackendHealthy{true};
+    std::unique_ptr<MetricsSpool> fSpool;
+    uint64_t fNumSpoolDropped{0}; // dropped by the size budget of the spool (already added to fNumDropped)
+    long long fSpoolRetryInterval{1000}; // milliseconds
+    std::size_t fSpoolReplayBatch{1000};
+    std::atomic<bool> fSpoolStopRequested{false};
+    std::mutex fSpoolMutex;
+    std::condition_variable fSpoolCondition;
+    std::thread fSpoolThread; // started only with a spool (otherwise the publisher checks the recovery)
+    std::chrono::steady_clock::time_point fLastRecoveryCheck;
+
+    // one-shot writes (not repeated by the next update) are kept until a flush has reached the server
+    std::map<std::string, std::map<std::string, std::string>> fPendingHashes; // key -> field -> latest value
+    std::vector<std::string> fPendingDelKeys;
+    std::vector<std::string> fPendingIndexFields;
+    bool fRunLabelsPending{false};
+    FlushBatch fFlush;
 
     std::mutex fMutex;
+    std::shared_ptr<RedisConnections> fConnections;
     std::shared_ptr<sw::redis::Redis> fClient;
+    // dedicated connection (not borrowed from the pool), because it lives as long as the plugin.
+    // null while the server is unreachable (re-created after the recovery by RecoverPipe())
     std::unique_ptr<sw::redis::Pipeline> fPipe;
     std::string fSeparator;
     std::string fServiceName;
@@ -183,7 +515,17 @@ private:
     std::string fStateKey;
     std::string fLastUpdateKey;
     std::string fLastUpdateNSKey;
+    std::string fDroppedKey;
+    std::string fQueuedCommandsKey;
+    std::string fFlushLatencyKey;
+    ShmStatKey fShmKey;
+
+    // compact layout: one hash per device (field = <sub-channel>:<metric>)
+    std::string fSocketKey;
+    std::vector<std::pair<std::string, std::string>> fSocketFields;
 
+    // legacy layout: hashes per metric (field = <id>:<sub-channel>). only with metrics-compat-keys=true
+    bool fCompatKeys{false};
     SocketMetricsKey fSockKey;
     SocketMetricsKey fSockSumKey;
     std::string fNumMessageKey;
@@ -193,15 +535,57 @@ private:
 
     // keys for time series data
     ProcessStatKey   fTsProcKey;
+    ShmStatKey       fTsShmKey;
 
     std::unordered_map<std::string, SocketProperty> fSocketProperties;
     std::unordered_map<std::string, SocketMetricsKey> fTsSockKey;
     std::unordered_map<std::string, SocketMetricsKey> fTsSockSumKey;
     std::unordered_map<std::string, int> fNumChannels;
+    // histograms of message size and inter-arrival time (registered by the device)
+    std::shared_ptr<ChannelHistogramRegistry> fChannelHistograms;
+    LogLinearHistogram::Snapshot fHistogramSnapshot;
+    // key = <channel-name>[<sub-channel-index>], value = p50, p90, p99 and max of size and gap
+    std::unordered_map<std::string, std::vector<std::string>> fTsHistKey;
+    // queue occupancy and backpressure (registered by the device)
+    std::shared_ptr<ChannelQueueRegistry> fChannelQueues;
+    std::chrono::steady_clock::time_point fQueueSampleTime;
+    // key = <channel-name>[<sub-channel-index>], value = depth, high-water mark, full, send-blocked and recv-wait
+    std::unordered_map<std::string, std::vector<std::string>> fTsQueueKey;
+    // custom metrics (registered by the device)
+    std::shared_ptr<CustomMetrics> fCustomMetrics;
+    std::chrono::steady_clock::time_point fCustomSampleTime;
+    // key = <kind>\t<name>, value = ts keys ts:<id>:custom:<kind>:<name>[-<stat>]
+    // (counter: total and rate, gauge: value, histogram: p50, p90, p99 and max)
+    std::unordered_map<std::string, std::vector<std::string>> fTsCustomKey;
+    std::unordered_map<std::string, uint64_t> fCustomCounterLast;
     std::string fRetentionMS{"0"};
+    // exporters other than RedisTimeSeries (prometheus, otlp)
+    bool fTsRedis{true};
+    std::vector<std::unique_ptr<MetricsExporter>> fExporters;
+    std::unordered_map<std::string, MetricLabels> fSeriesLabels;
+    // samples of time series are collected into one ts.madd per flush
+    // ("ts.madd" followed by <key> <timestamp> <value> triplets)
+    bool fTsMadd{true};
+    std::vector<std::string> fTsSamples;
     std::unordered_set<std::string> fRegisteredTSKeys;
+    // series to be created with one script call at the next flush (before the samples)
+    std::vector<std::string> fPendingTSKeys;
+    // compacted series <key>:<rule name> of all series (maintained by the server)
+    std::vector<CompactionRule> fCompactionRules;
+    std::string fCompactionRetentionMS{"0"};
+    // per-service sums across instances: ts:service:<service>[:<channel>]:<metric>.
+    // all instances add one value per bucket at the bucket timestamp to the series with DUPLICATE_POLICY SUM.
+    // these samples are not spooled (a replay would add them twice).
+    bool fServiceAggregate{false};
+    long long fServiceAggregateBucket{1000}; // milliseconds
+    std::unordered_map<std::string, ServiceSeries> fTsServiceKey; // key = <channel>\t<metric>
+    std::unordered_set<std::string> fRegisteredServiceKeys;
+    std::vector<std::string> fPendingServiceKeys;
     std::unordered_set<std::string> fRegisteredKeys;
-    std::unordered_set<std::string> fRegisteredSockKeys;
+    // index for the cleanup of expired instances (see DeleteExpiredFields())
+    std::string fLastUpdateIndexKey; // sorted set: member = id, score = last update (msec)
+    std::string fFieldIndexKey;      // set of "<key>\t<field>" written by this instance
+    std::unordered_set<std::string> fIndexedFields;
 };
 
 //_____________________________________________________________________________
@@ -0,0 +1,102 @@
+#ifndef DaqService_Plugins_MetricsQueue_h
+#define DaqService_Plugins_MetricsQueue_h
+
+// Bounded lock-free multi-producer queue for the hand-off of metric records
+// (array-based queue with per-cell sequence numbers by D. Vyukov).
+// TryPush() never blocks. It returns false when the queue is full.
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace daq::service {
+
+template <typename T>
+class MetricsQueue {
+public:
+    explicit MetricsQueue(std::size_t capacity)
+    {
+        std::size_t n = 2;
+        while (n < capacity) {
+            n <<= 1;
+        }
+        fMask   = n - 1;
+        fBuffer = std::make_unique<Cell[]>(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            fBuffer[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+    MetricsQueue(const MetricsQueue&) = delete;
+    MetricsQueue& operator=(const MetricsQueue&) = delete;
+    ~MetricsQueue() = default;
+
+    std::size_t Capacity() const {
+        return fMask + 1;
+    }
+
+    bool TryPush(T &&v)
+    {
+        auto pos = fEnqueuePos.load(std::memory_order_relaxed);
+        Cell *cell;
+        while (true) {
+            cell = &fBuffer[pos & fMask];
+            const auto seq = cell->sequence.load(std::memory_order_acquire);
+            const auto dif = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+            if (dif == 0) {
+                if (fEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {
+                // full
+                return false;
+            } else {
+                pos = fEnqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = std::move(v);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool TryPop(T &v)
+    {
+        auto pos = fDequeuePos.load(std::memory_order_relaxed);
+        Cell *cell;
+        while (true) {
+            cell = &fBuffer[pos & fMask];
+            const auto seq = cell->sequence.load(std::memory_order_acquire);
+            const auto dif = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1);
+            if (dif == 0) {
+                if (fDequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {
+                // empty
+                return false;
+            } else {
+                pos = fDequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+        v = std::move(cell->data);
+        cell->sequence.store(pos + fMask + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    static constexpr std::size_t CacheLineSize{64};
+
+    struct Cell {
+        std::atomic<std::size_t> sequence;
+        T data;
+    };
+
+    std::unique_ptr<Cell[]> fBuffer;
+    std::size_t fMask{0};
+    alignas(CacheLineSize) std::atomic<std::size_t> fEnqueuePos{0};
+    alignas(CacheLineSize) std::atomic<std::size_t> fDequeuePos{0};
+};
+
+} // namespace daq::service
+
+#endif
@@ -0,0 +1,296 @@
+#ifndef DaqService_Plugins_MetricsShmTable_h
+#define DaqService_Plugins_MetricsShmTable_h
+
+// Table of metrics in POSIX shared memory (/dev/shm/nestdaq-metrics.<id>).
+// The metrics plugin of each device writes the latest sample of each time series,
+// and the per-host aggregator (daq-metrics-aggregator) reads all tables and sends them in one batch.
+//
+// One writer per table. Each entry is protected by a sequence lock:
+// the sequence number is odd while the writer updates the entry, and the reader retries
+// when it sees an odd or changed sequence number. No system call is made on the write path.
+// The entry of a removed series is freed (empty key) and reused by the next Add(). The generation
+// of an entry changes when it is reused or its labels are rewritten, so that the reader re-reads them.
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace daq::service {
+
+class MetricsShmTable {
+public:
+    static constexpr std::string_view NamePrefix{"nestdaq-metrics."};
+    static constexpr uint64_t Magic{0x6e65737464617131}; // "nestdaq1"
+    static constexpr uint32_t Version{2};
+    static constexpr std::size_t IdSize{64};
+    static constexpr std::size_t KeySize{128};
+    static constexpr std::size_t LabelsSize{256};
+
+    struct Header {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t capacity;
+        std::atomic<uint32_t> nEntries; // entries [0, nEntries) are in use or free (empty key)
+        int32_t pid;                    // pid of the writer
+        char id[IdSize];
+    };
+
+    struct alignas(64) Entry {
+        std::atomic<uint32_t> seq;
+        std::atomic<uint32_t> generation; // incremented when the key or the labels are rewritten
+        char key[KeySize];        // empty if the entry is free
+        char labels[LabelsSize];  // "<name>=<value>\n"...
+        std::atomic<double> value;
+        std::atomic<int64_t> timestamp; // milliseconds since epoch
+    };
+
+    MetricsShmTable(const MetricsShmTable&) = delete;
+    MetricsShmTable& operator=(const MetricsShmTable&) = delete;
+    ~MetricsShmTable() {
+        if (fHeader != nullptr) {
+            munmap(fHeader, fSize);
+        }
+        if (fOwner) {
+            shm_unlink(fName.data());
+        }
+    }
+
+    // shm_open() name of the table of a device
+    static std::string Name(std::string_view id) {
+        return "/" + std::string(NamePrefix) + std::string(id);
+    }
+
+    // writer (metrics plugin)
+    static std::unique_ptr<MetricsShmTable> Create(std::string_view id, uint32_t capacity) {
+        const auto name = Name(id);
+        shm_unlink(name.data());
+        const auto fd = shm_open(name.data(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd < 0) {
+            return nullptr;
+        }
+        const auto size = sizeof(Header) + sizeof(Entry) * capacity;
+        if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+            close(fd);
+            shm_unlink(name.data());
+            return nullptr;
+        }
+        auto p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) {
+            shm_unlink(name.data());
+            return nullptr;
+        }
+        std::unique_ptr<MetricsShmTable> ret(new MetricsShmTable(name, p, size, true));
+        auto h = ret->fHeader;
+        h->version  = Version;
+        h->capacity = capacity;
+        h->nEntries.store(0, std::memory_order_relaxed);
+        h->pid      = getpid();
+        std::strncpy(h->id, id.data(), std::min(id.size(), IdSize - 1));
+        std::atomic_thread_fence(std::memory_order_release);
+        h->magic    = Magic;
+        return ret;
+    }
+
+    // reader (aggregator). name = shm_open() name
+    static std::unique_ptr<MetricsShmTable> Open(const std::string &name) {
+        const auto fd = shm_open(name.data(), O_RDONLY, 0);
+        if (fd < 0) {
+            return nullptr;
+        }
+        struct stat st;
+        if ((fstat(fd, &st) != 0) || (static_cast<std::size_t>(st.st_size) < sizeof(Header))) {
+            close(fd);
+            return nullptr;
+        }
+        const auto size = static_cast<std::size_t>(st.st_size);
+        auto p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) {
+            return nullptr;
+        }
+        std::unique_ptr<MetricsShmTable> ret(new MetricsShmTable(name, p, size, false));
+        ret->fDev = st.st_dev;
+        ret->fIno = st.st_ino;
+        const auto h = ret->fHeader;
+        if ((h->magic != Magic) || (h->version != Version)
+                || (size < sizeof(Header) + sizeof(Entry) * h->capacity)) {
+            return nullptr;
+        }
+        return ret;
+    }
+
+    // add an entry (a free entry is reused first).
+    // returns the index or -1 if the table is full or the key or labels do not fit (writer only)
+    int Add(std::string_view key, std::string_view labels) {
+        if ((key.size() >= KeySize) || (labels.size() >= LabelsSize)) {
+            return -1;
+        }
+        if (!fFree.empty()) {
+            const auto i = fFree.back();
+            fFree.pop_back();
+            Modify(i, [key, labels](Entry &e) {
+                e.generation.fetch_add(1, std::memory_order_relaxed);
+                Copy(e.key, key);
+                Copy(e.labels, labels);
+                e.value.store(0, std::memory_order_relaxed);
+                e.timestamp.store(0, std::memory_order_relaxed);
+            });
+            return static_cast<int>(i);
+        }
+        const auto n = fHeader->nEntries.load(std::memory_order_relaxed);
+        if (n >= fHeader->capacity) {
+            return -1;
+        }
+        auto &e = fEntries[n];
+        e.seq.store(0, std::memory_order_relaxed);
+        e.generation.store(0, std::memory_order_relaxed);
+        Copy(e.key, key);
+        Copy(e.labels, labels);
+        e.value.store(0, std::memory_order_relaxed);
+        e.timestamp.store(0, std::memory_order_relaxed);
+        fHeader->nEntries.store(n + 1, std::memory_order_release);
+        return static_cast<int>(n);
+    }
+
+    // free the entry (writer only)
+    void Remove(int i) {
+        Modify(i, [](Entry &e) {
+            e.generation.fetch_add(1, std::memory_order_relaxed);
+            e.key[0]    = '\0';
+            e.labels[0] = '\0';
+            e.value.store(0, std::memory_order_relaxed);
+            e.timestamp.store(0, std::memory_order_relaxed);
+        });
+        fFree.push_back(static_cast<uint32_t>(i));
+    }
+
+    // rewrite the labels. returns false if they do not fit (writer only)
+    bool SetLabels(int i, std::string_view labels) {
+        if (labels.size() >= LabelsSize) {
+            return false;
+        }
+        Modify(i, [labels](Entry &e) {
+            e.generation.fetch_add(1, std::memory_order_relaxed);
+            Copy(e.labels, labels);
+        });
+        return true;
+    }
+
+    // (writer only)
+    void Update(int i, double value, int64_t timestamp) {
+        Modify(i, [value, timestamp](Entry &e) {
+            e.value.store(value, std::memory_order_relaxed);
+            e.timestamp.store(timestamp, std::memory_order_relaxed);
+        });
+    }
+
+    // (reader) returns false if the entry is being updated
+    bool Read(uint32_t i, double &value, int64_t &timestamp, uint32_t &generation) const {
+        const auto &e = fEntries[i];
+        const auto s0 = e.seq.load(std::memory_order_acquire);
+        if (s0 & 1) {
+            return false;
+        }
+        value      = e.value.load(std::memory_order_relaxed);
+        timestamp  = e.timestamp.load(std::memory_order_relaxed);
+        generation = e.generation.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return s0 == e.seq.load(std::memory_order_relaxed);
+    }
+
+    // (reader) key (empty if the entry is free) and labels. returns false if the entry is being updated
+    bool ReadKey(uint32_t i, std::string &key, std::string &labels, uint32_t &generation) const {
+        const auto &e = fEntries[i];
+        const auto s0 = e.seq.load(std::memory_order_acquire);
+        if (s0 & 1) {
+            return false;
+        }
+        key.assign(e.key, strnlen(e.key, KeySize));
+        labels.assign(e.labels, strnlen(e.labels, LabelsSize));
+        generation = e.generation.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return s0 == e.seq.load(std::memory_order_relaxed);
+    }
+
+    // true if Add() finds an entry (writer only)
+    bool HasRoom() const {
+        return !fFree.empty() || (fHeader->nEntries.load(std::memory_order_relaxed) < fHeader->capacity);
+    }
+    uint32_t Capacity() const {
+        return fHeader->capacity;
+    }
+    uint32_t Size() const {
+        return fHeader->nEntries.load(std::memory_order_acquire);
+    }
+    const char* Id() const {
+        return fHeader->id;
+    }
+    int32_t Pid() const {
+        return fHeader->pid;
+    }
+    // (reader) true if the name still refers to the mapped table.
+    // false after the writer has exited and a new writer with the same id has created a new table.
+    bool IsLinked() const {
+        const auto fd = shm_open(fName.data(), O_RDONLY, 0);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        const auto ret = (fstat(fd, &st) == 0) && (st.st_dev == fDev) && (st.st_ino == fIno);
+        close(fd);
+        return ret;
+    }
+    const std::string& GetName() const {
+        return fName;
+    }
+
+private:
+    static void Copy(char *dst, std::string_view src) {
+        std::memcpy(dst, src.data(), src.size());
+        dst[src.size()] = '\0';
+    }
+
+    // the entry is written under the sequence lock (writer only)
+    template <typename F>
+    void Modify(int i, F f) {
+        auto &e = fEntries[i];
+        const auto s = e.seq.load(std::memory_order_relaxed);
+        e.seq.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        f(e);
+        e.seq.store(s + 2, std::memory_order_release);
+    }
+
+    MetricsShmTable(const std::string &name, void *p, std::size_t size, bool owner)
+        : fName(name),
+          fSize(size),
+          fOwner(owner),
+          fHeader(static_cast<Header*>(p)),
+          fEntries(reinterpret_cast<Entry*>(static_cast<char*>(p) + sizeof(Header)))
+    {}
+
+    std::string fName;
+    std::size_t fSize{0};
+    bool fOwner{false};
+    // file of the mapping (reader)
+    dev_t fDev{0};
+    ino_t fIno{0};
+    Header *fHeader{nullptr};
+    Entry *fEntries{nullptr};
+    std::vector<uint32_t> fFree; // removed entries (writer)
+};
+
+} // namespace daq::service
+
+#endif
@@ -0,0 +1,279 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <utility>
+
+#include "plugins/MetricsSpool.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+constexpr uint64_t Magic{0x6e65737464617132}; // "nestdaq2"
+constexpr uint32_t Version{1};
+constexpr std::string_view Suffix{".spool"};
+
+// record = [size (4)][key length (2)][value length (2)][timestamp (8)][key][value] (aligned to 8 bytes)
+constexpr std::size_t RecordHeaderSize{16};
+
+//_____________________________________________________________________________
+constexpr std::size_t Align(std::size_t n)
+{
+    return (n + 7) & ~std::size_t{7};
+}
+} // namespace
+
+struct daq::service::MetricsSpool::Header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t capacity; // bytes of the data area
+    uint64_t writePos;
+    uint64_t readPos;
+    uint64_t nRecords;
+    uint64_t nRead;
+    uint64_t padding;
+};
+
+struct daq::service::MetricsSpool::Segment {
+    uint64_t seq{0};
+    std::string path;
+    std::size_t size{0};
+    Header *h{nullptr};
+    char *data{nullptr};
+
+    ~Segment() {
+        if (h != nullptr) {
+            munmap(h, size);
+        }
+    }
+    bool Exhausted() const {
+        return h->readPos >= h->writePos;
+    }
+};
+
+//_____________________________________________________________________________
+daq::service::MetricsSpool::MetricsSpool(const std::string &dir, const std::string &id, std::size_t segmentSize, std::size_t maxSize)
+    : fDir(dir),
+      fPrefix(id),
+      fSegmentSize(std::max(Align(segmentSize), sizeof(Header) + 4096)),
+      fMaxSegments(std::max<std::size_t>(2, maxSize / fSegmentSize))
+{
+    std::replace(fPrefix.begin(), fPrefix.end(), '/', '_');
+    fs::create_directories(fDir);
+
+    // segments left by a previous process of the same device
+    std::map<uint64_t, std::string> found;
+    for (const auto &entry : fs::directory_iterator(fDir)) {
+        const auto name = entry.path().filename().string();
+        if ((name.size() <= fPrefix.size() + 1 + Suffix.size())
+                || (name.compare(0, fPrefix.size() + 1, fPrefix + ".") != 0)
+                || (name.compare(name.size() - Suffix.size(), Suffix.size(), Suffix.data()) != 0)) {
+            continue;
+        }
+        const auto seq = name.substr(fPrefix.size() + 1, name.size() - fPrefix.size() - 1 - Suffix.size());
+        if (seq.empty() || (seq.find_first_not_of("0123456789") != std::string::npos)) {
+            continue;
+        }
+        found.emplace(std::stoull(seq), entry.path().string());
+    }
+    for (const auto &[seq, path] : found) {
+        const auto fd = open(path.data(), O_RDWR);
+        if (fd < 0) {
+            continue;
+        }
+        const auto size = static_cast<std::size_t>(lseek(fd, 0, SEEK_END));
+        auto p = (size > sizeof(Header)) ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (p == MAP_FAILED) {
+            unlink(path.data());
+            continue;
+        }
+        auto s  = std::make_unique<Segment>();
+        s->seq  = seq;
+        s->path = path;
+        s->size = size;
+        s->h    = static_cast<Header*>(p);
+        s->data = static_cast<char*>(p) + sizeof(Header);
+        if ((s->h->magic != Magic) || (s->h->version != Version)
+                || (sizeof(Header) + s->h->capacity > size) || (s->h->writePos > s->h->capacity)
+                || (s->h->readPos > s->h->writePos) || s->Exhausted()) {
+            unlink(path.data());
+            continue;
+        }
+        fSegments.push_back(std::move(s));
+    }
+}
+
+//_____________________________________________________________________________
+daq::service::MetricsSpool::~MetricsSpool()
+{
+    // keep the segments which are not replayed yet for the next process
+    for (const auto &s : fSegments) {
+        if (s->Exhausted()) {
+            unlink(s->path.data());
+        }
+    }
+}
+
+//_____________________________________________________________________________
+bool daq::service::MetricsSpool::AddSegment(uint64_t seq)
+{
+    std::ostringstream name;
+    name << fPrefix << "." << std::setw(20) << std::setfill('0') << seq << Suffix;
+    const auto path = (fs::path(fDir) / name.str()).string();
+
+    const auto fd = open(path.data(), O_CREAT | O_TRUNC | O_RDWR, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    if (ftruncate(fd, static_cast<off_t>(fSegmentSize)) != 0) {
+        close(fd);
+        unlink(path.data());
+        return false;
+    }
+    auto p = mmap(nullptr, fSegmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        unlink(path.data());
+        return false;
+    }
+    auto s  = std::make_unique<Segment>();
+    s->seq  = seq;
+    s->path = path;
+    s->size = fSegmentSize;
+    s->h    = static_cast<Header*>(p);
+    s->data = static_cast<char*>(p) + sizeof(Header);
+    s->h->version  = Version;
+    s->h->capacity = fSegmentSize - sizeof(Header);
+    s->h->writePos = 0;
+    s->h->readPos  = 0;
+    s->h->nRecords = 0;
+    s->h->nRead    = 0;
+    s->h->magic    = Magic;
+    fSegments.push_back(std::move(s));
+    return true;
+}
+
+//_____________________________________________________________________________
+bool daq::service::MetricsSpool::Append(std::string_view key, int64_t timestamp, std::string_view value)
+{
+    const auto n = Align(RecordHeaderSize + key.size() + value.size());
+    if ((key.size() > UINT16_MAX) || (value.size() > UINT16_MAX) || (n > fSegmentSize - sizeof(Header))) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock{fMutex};
+    if (fSegments.empty() || (fSegments.back()->h->writePos + n > fSegments.back()->h->capacity)) {
+        if (fSegments.size() >= fMaxSegments) {
+            // size budget is exhausted. drop the oldest samples.
+            fNumDropped += fSegments.front()->h->nRecords - fSegments.front()->h->nRead;
+            RemoveFront();
+        }
+        if (!AddSegment(fSegments.empty() ? 0 : fSegments.back()->seq + 1)) {
+            return false;
+        }
+    }
+    auto &s = *fSegments.back();
+    auto p  = s.data + s.h->writePos;
+    const auto size     = static_cast<uint32_t>(n);
+    const auto keySize  = static_cast<uint16_t>(key.size());
+    const auto valueSize = static_cast<uint16_t>(value.size());
+    std::memcpy(p,      &size,      sizeof(size));
+    std::memcpy(p + 4,  &keySize,   sizeof(keySize));
+    std::memcpy(p + 6,  &valueSize, sizeof(valueSize));
+    std::memcpy(p + 8,  &timestamp, sizeof(timestamp));
+    std::memcpy(p + RecordHeaderSize, key.data(), key.size());
+    std::memcpy(p + RecordHeaderSize + key.size(), value.data(), value.size());
+    s.h->writePos += n;
+    ++s.h->nRecords;
+    return true;
+}
+
+//_____________________________________________________________________________
+bool daq::service::MetricsSpool::Empty()
+{
+    std::lock_guard<std::mutex> lock{fMutex};
+    return std::all_of(fSegments.cbegin(), fSegments.cend(), [](const auto &s) {
+        return s->Exhausted();
+    });
+}
+
+//_____________________________________________________________________________
+std::size_t daq::service::MetricsSpool::Peek(std::vector<Record> &records, std::size_t n)
+{
+    records.clear();
+    std::lock_guard<std::mutex> lock{fMutex};
+    while ((fSegments.size() > 1) && fSegments.front()->Exhausted()) {
+        RemoveFront();
+    }
+    fPeekCount = 0;
+    if (fSegments.empty()) {
+        return 0;
+    }
+    const auto &s = *fSegments.front();
+    auto pos = s.h->readPos;
+    while ((records.size() < n) && (pos < s.h->writePos)) {
+        const auto p = s.data + pos;
+        uint32_t size;
+        uint16_t keySize;
+        uint16_t valueSize;
+        Record r;
+        std::memcpy(&size,        p,     sizeof(size));
+        std::memcpy(&keySize,     p + 4, sizeof(keySize));
+        std::memcpy(&valueSize,   p + 6, sizeof(valueSize));
+        std::memcpy(&r.timestamp, p + 8, sizeof(r.timestamp));
+        if ((size < RecordHeaderSize) || (pos + size > s.h->writePos)) {
+            // corrupted. skip the rest of the segment
+            pos = s.h->writePos;
+            break;
+        }
+        r.key.assign(p + RecordHeaderSize, keySize);
+        r.value.assign(p + RecordHeaderSize + keySize, valueSize);
+        records.push_back(std::move(r));
+        pos += size;
+    }
+    fPeekSeq   = s.seq;
+    fPeekEnd   = pos;
+    fPeekCount = records.size();
+    return records.size();
+}
+
+//_____________________________________________________________________________
+void daq::service::MetricsSpool::Pop()
+{
+    std::lock_guard<std::mutex> lock{fMutex};
+    if (fSegments.empty() || (fSegments.front()->seq != fPeekSeq)) {
+        // the segment has been dropped in the meantime
+        return;
+    }
+    auto &s = *fSegments.front();
+    if (fPeekEnd > s.h->readPos) {
+        s.h->readPos = fPeekEnd;
+        s.h->nRead  += fPeekCount;
+    }
+    fPeekCount = 0;
+    if (s.Exhausted()) {
+        if (fSegments.size() > 1) {
+            RemoveFront();
+        } else {
+            // reuse the write segment from the beginning
+            s.h->writePos = 0;
+            s.h->readPos  = 0;
+            s.h->nRecords = 0;
+            s.h->nRead    = 0;
+        }
+    }
+}
+
+//_____________________________________________________________________________
+void daq::service::MetricsSpool::RemoveFront()
+{
+    unlink(fSegments.front()->path.data());
+    fSegments.pop_front();
+}
@@ -0,0 +1,71 @@
+#ifndef DaqService_Plugins_MetricsSpool_h
+#define DaqService_Plugins_MetricsSpool_h
+
+// Write-ahead spool of time series samples which could not be sent to Redis.
+// Samples are appended to memory-mapped segment files <dir>/<id>.<sequence>.spool of a fixed size.
+// When the size budget is exhausted, the oldest segment is dropped.
+// The read position is kept in the segment header, so that the samples left by a previous process
+// of the same device are replayed after restart (the data survives a crash of the process,
+// but not of the host, because the segments are not synced).
+//
+// One writer (publisher thread) and one reader (replay thread).
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace daq::service {
+
+class MetricsSpool {
+public:
+    struct Record {
+        std::string key;
+        int64_t timestamp{0}; // milliseconds since epoch
+        std::string value;
+    };
+
+    MetricsSpool(const std::string &dir, const std::string &id, std::size_t segmentSize, std::size_t maxSize);
+    MetricsSpool(const MetricsSpool&) = delete;
+    MetricsSpool& operator=(const MetricsSpool&) = delete;
+    ~MetricsSpool();
+
+    // returns false if the record does not fit in a segment or the segment could not be created
+    bool Append(std::string_view key, int64_t timestamp, std::string_view value);
+    bool Empty();
+    // number of records lost by the size budget
+    uint64_t NumDropped() const {
+        return fNumDropped;
+    }
+    // copy at most n records from the read position. the records stay in the spool until Pop()
+    std::size_t Peek(std::vector<Record> &records, std::size_t n);
+    // remove the records returned by the last Peek()
+    void Pop();
+
+private:
+    struct Header;
+    struct Segment;
+
+    bool AddSegment(uint64_t seq);
+    void RemoveFront();
+
+    std::string fDir;
+    std::string fPrefix;
+    std::size_t fSegmentSize{0};
+    std::size_t fMaxSegments{0};
+    uint64_t fNumDropped{0};
+
+    std::mutex fMutex;
+    std::deque<std::unique_ptr<Segment>> fSegments; // front = oldest, back = write segment
+    uint64_t fPeekSeq{0};
+    uint64_t fPeekEnd{0};
+    uint64_t fPeekCount{0};
+};
+
+} // namespace daq::service
+
+#endif
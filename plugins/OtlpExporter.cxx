@@ -0,0 +1,120 @@
+#include <cstdlib>
+#include <vector>
+
+#include <opentelemetry/exporters/otlp/otlp_http_metric_exporter_factory.h>
+#include <opentelemetry/exporters/otlp/otlp_http_metric_exporter_options.h>
+#include <opentelemetry/sdk/instrumentationscope/instrumentation_scope.h>
+#include <opentelemetry/sdk/metrics/data/metric_data.h>
+#include <opentelemetry/sdk/metrics/export/metric_producer.h>
+#include <opentelemetry/sdk/metrics/push_metric_exporter.h>
+#include <opentelemetry/sdk/resource/resource.h>
+
+#include <fairmq/FairMQLogger.h>
+
+#include "plugins/OtlpExporter.h"
+
+namespace otlp     = opentelemetry::exporter::otlp;
+namespace metrics  = opentelemetry::sdk::metrics;
+namespace resource = opentelemetry::sdk::resource;
+namespace scope    = opentelemetry::sdk::instrumentationscope;
+
+namespace {
+static constexpr std::string_view MyClass{"daq::service::OtlpExporter"};
+static constexpr std::string_view NamePrefix{"nestdaq."};
+}
+
+//_____________________________________________________________________________
+daq::service::OtlpExporter::OtlpExporter(const std::string &url,
+        const std::string &serviceName,
+        const std::string &id,
+        long long exportIntervalMS)
+    : fExportInterval(exportIntervalMS),
+      fLastExport(std::chrono::steady_clock::now())
+{
+    otlp::OtlpHttpMetricExporterOptions options;
+    options.url = url;
+    fExporter = otlp::OtlpHttpMetricExporterFactory::Create(options);
+    fResource = std::make_unique<resource::Resource>(resource::Resource::Create({
+        {"service.name",        serviceName},
+        {"service.instance.id", id},
+    }));
+    fScope = scope::InstrumentationScope::Create("nestdaq.metrics");
+    LOG(info) << MyClass << " export to " << url << " every " << exportIntervalMS << " ms";
+}
+
+//_____________________________________________________________________________
+daq::service::OtlpExporter::~OtlpExporter()
+{
+    Export();
+    if (fExporter) {
+        fExporter->Shutdown();
+    }
+}
+
+//_____________________________________________________________________________
+void daq::service::OtlpExporter::Add(const std::string &key, const MetricLabels &labels, int64_t timestamp, const std::string &value)
+{
+    auto itr = labels.find("data");
+    auto name = std::string(NamePrefix) + ((itr != labels.end()) ? itr->second : key);
+    auto &p = fPoints[name + " " + key];
+    p.name      = std::move(name);
+    p.labels    = labels;
+    p.labels.erase("data");
+    p.value     = std::strtod(value.data(), nullptr);
+    p.timestamp = timestamp;
+}
+
+//_____________________________________________________________________________
+void daq::service::OtlpExporter::Export()
+{
+    if (fPoints.empty() || !fExporter) {
+        return;
+    }
+    const auto now = std::chrono::system_clock::now();
+    std::vector<metrics::MetricData> data;
+    for (const auto &[k, p] : fPoints) {
+        if (data.empty() || (data.back().instrument_descriptor.name_ != p.name)) {
+            metrics::MetricData d;
+            d.instrument_descriptor = metrics::InstrumentDescriptor{p.name, "", "",
+                                      metrics::InstrumentType::kObservableGauge,
+                                      metrics::InstrumentValueType::kDouble};
+            d.aggregation_temporality = metrics::AggregationTemporality::kCumulative;
+            d.start_ts = now;
+            d.end_ts   = now;
+            data.push_back(std::move(d));
+        }
+        metrics::PointDataAttributes a;
+        for (const auto &[lk, lv] : p.labels) {
+            a.attributes.SetAttribute(lk, lv);
+        }
+        metrics::LastValuePointData v;
+        v.value_              = p.value;
+        v.is_lastvalue_valid_ = true;
+        v.sample_ts_          = std::chrono::system_clock::time_point(std::chrono::milliseconds(p.timestamp));
+        a.point_data = v;
+        data.back().point_data_attr_.push_back(std::move(a));
+    }
+    fPoints.clear();
+
+    metrics::ResourceMetrics rm;
+    rm.resource_ = fResource.get();
+    metrics::ScopeMetrics sm;
+    sm.scope_       = fScope.get();
+    sm.metric_data_ = std::move(data);
+    rm.scope_metric_data_.push_back(std::move(sm));
+    const auto result = fExporter->Export(rm);
+    if (result != opentelemetry::sdk::common::ExportResult::kSuccess) {
+        LOG(warn) << MyClass << " export failed. result = " << static_cast<int>(result);
+    }
+}
+
+//_____________________________________________________________________________
+void daq::service::OtlpExporter::Flush()
+{
+    const auto now = std::chrono::steady_clock::now();
+    if (now - fLastExport < fExportInterval) {
+        return;
+    }
+    fLastExport = now;
+    Export();
+}
@@ -0,0 +1,60 @@
+#ifndef DaqService_Plugins_OtlpExporter_h
+#define DaqService_Plugins_OtlpExporter_h
+
+// OTLP/HTTP export of the metrics with opentelemetry-cpp (built with -DWITH_OTEL_CPP=ON).
+// Samples are collected as gauges and sent in one batch per export interval.
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "plugins/MetricsExporter.h"
+
+namespace opentelemetry::sdk::metrics {
+class PushMetricExporter;
+}
+namespace opentelemetry::sdk::resource {
+class Resource;
+}
+namespace opentelemetry::sdk::instrumentationscope {
+class InstrumentationScope;
+}
+
+namespace daq::service {
+
+class OtlpExporter : public MetricsExporter {
+public:
+    OtlpExporter(const std::string &url,
+                 const std::string &serviceName,
+                 const std::string &id,
+                 long long exportIntervalMS);
+    OtlpExporter(const OtlpExporter&) = delete;
+    OtlpExporter& operator=(const OtlpExporter&) = delete;
+    ~OtlpExporter() override;
+
+    void Add(const std::string &key, const MetricLabels &labels, int64_t timestamp, const std::string &value) override;
+    void Flush() override;
+
+private:
+    struct Point {
+        std::string name;
+        MetricLabels labels;
+        double value{0};
+        int64_t timestamp{0};
+    };
+
+    void Export();
+
+    std::unique_ptr<opentelemetry::sdk::metrics::PushMetricExporter> fExporter;
+    std::unique_ptr<opentelemetry::sdk::resource::Resource> fResource;
+    std::unique_ptr<opentelemetry::sdk::instrumentationscope::InstrumentationScope> fScope;
+    std::chrono::milliseconds fExportInterval;
+    std::chrono::steady_clock::time_point fLastExport;
+    // key = <metric name> <ts key>
+    std::map<std::string, Point> fPoints;
+};
+
+} // namespace daq::service
+
+#endif
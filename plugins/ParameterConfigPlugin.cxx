@@ -1,5 +1,8 @@
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
 #include <iterator>
+#include <mutex>
 #include <unordered_map>
 #include <vector>
 
@@ -12,6 +15,7 @@
 #include "plugins/Constants.h"
 #include "plugins/Functions.h"
 #include "plugins/ParameterConfigPlugin.h"
+#include "plugins/RedisConnections.h"
 
 using namespace std::literals::string_literals;
 
@@ -95,7 +99,8 @@ ParameterConfigPlugin::ParameterConfigPlugin(std::string_view name,
         serverUri = GetProperty<std::string>(ServiceRegistryUri.data());
     }
     if (!serverUri.empty()) {
-        fClient = std::make_shared<sw::redis::Redis>(serverUri);
+        fConnections = GetRedisConnections(*this, serverUri);
+        fClient      = fConnections->GetClient();
     }
 
     SubscribeToDeviceStateChange([this](DeviceState newState) {
@@ -127,13 +132,16 @@ ParameterConfigPlugin::ParameterConfigPlugin(std::string_view name,
             LOG(error) << MyClass << " unknown error in CheckThread";
         }
     });
-    fSubscriberThread.detach();
 }
 
 //_____________________________________________________________________________
 ParameterConfigPlugin::~ParameterConfigPlugin()
 {
     UnsubscribeFromDeviceStateChange();
+    fPluginShutdownRequested = true;
+    if (fSubscriberThread.joinable()) {
+        fSubscriberThread.join();
+    }
     LOG(debug) << MyClass << " bye";
 }
 
@@ -370,43 +378,56 @@ void ParameterConfigPlugin::SetPropertyOfReservedOption(std::string_view name, s
 //_____________________________________________________________________________
 void ParameterConfigPlugin::SubscribeToParameterChange()
 {
-    using opt = ParameterConfigPlugin::OptionKey;
-    LOG(debug) << " create a subscriber. (parameter change)";
-    auto sub = fClient->subscriber();
+    if (!fConnections) {
+        return;
+    }
+    LOG(debug) << " subscribe to parameter change (shared subscriber)";
 
-    const auto &serverUri = GetProperty<std::string>(opt::ServerUri.data());
+    const auto &serverUri = fConnections->GetUri();
     const auto dbNumber = serverUri.substr(serverUri.find_last_of("/")+1);
     LOG(debug) << " db number = " << dbNumber;
     const std::string redisKeySpaceNotificationChannel = RedisKeySpacePrefix.data() + dbNumber + "__:"s + fKey;
     const std::string redisKeySpaceNotificationGroupChannel = RedisKeySpacePrefix.data() + dbNumber + "__:"s + fGroupKey;
     LOG(debug) << " key-space-notification channel = " << redisKeySpaceNotificationChannel << ", " << redisKeySpaceNotificationGroupChannel;
 
-    sub.on_message([this, &redisKeySpaceNotificationChannel, &redisKeySpaceNotificationGroupChannel](auto channel, auto msg) {
-        //LOG(debug) << MyClass << " on_message(MESSAGE): channel = " << channel << " msg = " << msg;
-        if (redisKeySpaceNotificationChannel!=channel && redisKeySpaceNotificationGroupChannel!=channel) {
-            return;
+    // notifications are handed over from the shared subscriber thread and the parameters are read in this thread.
+    // successive notifications are merged into one ReadParameters().
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool changed{false};
+    auto onMessage = [&mtx, &cv, &changed](const auto &, const auto &) {
+        {
+            std::lock_guard<std::mutex> lock{mtx};
+            changed = true;
         }
-        ReadParameters();
-    });
-
-    sub.subscribe({redisKeySpaceNotificationChannel, redisKeySpaceNotificationGroupChannel});
+        cv.notify_one();
+    };
+    const std::vector<uint64_t> ids{
+        fConnections->Subscribe(redisKeySpaceNotificationChannel, onMessage),
+        fConnections->Subscribe(redisKeySpaceNotificationGroupChannel, onMessage),
+    };
 
     while (!fPluginShutdownRequested) {
+        {
+            std::unique_lock<std::mutex> lock{mtx};
+            if (!cv.wait_for(lock, std::chrono::milliseconds(100), [&changed]() {
+            return changed;
+            })) {
+                continue;
+            }
+            changed = false;
+        }
         try {
-            sub.consume();
-        } catch (const sw::redis::TimeoutError &e) {
-            // try again.
-        } catch (const sw::redis::Error &e) {
-            LOG(error) << MyClass << "::" << __func__ << ": error in consume(): " << e.what();
-            break;
+            ReadParameters();
         } catch (const std::exception& e) {
-            LOG(error) << MyClass << "::" << __func__ << ": error in consume(): " << e.what();
-            break;
+            LOG(error) << MyClass << "::" << __func__ << ": error in ReadParameters(): " << e.what();
         } catch (...) {
             LOG(error) << MyClass << "::" << __func__ << ": unknown exception";
-            break;
         }
     }
+    for (auto id : ids) {
+        fConnections->Unsubscribe(id);
+    }
     LOG(debug) << " " << __func__ << " exit.";
 }
 
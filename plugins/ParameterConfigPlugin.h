@@ -5,6 +5,7 @@
 
 #include <atomic>
 #include <cmath>
+#include <memory>
 #include <string>
 #include <string_view>
 #include <thread>
@@ -22,6 +23,8 @@ namespace daq::service {
 
 static constexpr std::string_view ParametersPrefix{"parameters"};
 
+class RedisConnections;
+
 class ParameterConfigPlugin : public fair::mq::Plugin
 {
 public:
@@ -39,6 +42,7 @@ public:
     ~ParameterConfigPlugin() override;
 
 private:
+    std::shared_ptr<RedisConnections> fConnections;
     std::shared_ptr<sw::redis::Redis> fClient;
 
     std::string fId;
@@ -0,0 +1,71 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <utility>
+
+#include "plugins/ProcFile.h"
+
+//_____________________________________________________________________________
+daq::service::ProcFile::ProcFile(const std::string &path)
+{
+    Open(path);
+}
+
+//_____________________________________________________________________________
+daq::service::ProcFile::ProcFile(ProcFile &&other) noexcept
+    : fFd(std::exchange(other.fFd, -1))
+{
+}
+
+//_____________________________________________________________________________
+daq::service::ProcFile& daq::service::ProcFile::operator=(ProcFile &&other) noexcept
+{
+    if (this != &other) {
+        Close();
+        fFd = std::exchange(other.fFd, -1);
+    }
+    return *this;
+}
+
+//_____________________________________________________________________________
+daq::service::ProcFile::~ProcFile()
+{
+    Close();
+}
+
+//_____________________________________________________________________________
+void daq::service::ProcFile::Close()
+{
+    if (fFd >= 0) {
+        ::close(fFd);
+        fFd = -1;
+    }
+}
+
+//_____________________________________________________________________________
+bool daq::service::ProcFile::Open(const std::string &path)
+{
+    Close();
+    fFd = ::open(path.data(), O_RDONLY | O_CLOEXEC);
+    return fFd >= 0;
+}
+
+//_____________________________________________________________________________
+std::string_view daq::service::ProcFile::Read(char *buf, std::size_t n) const
+{
+    if (fFd < 0) {
+        return {};
+    }
+    std::size_t nread = 0;
+    while (nread < n) {
+        const auto ret = ::pread(fFd, buf + nread, n - nread, static_cast<off_t>(nread));
+        if (ret < 0) {
+            return {};
+        }
+        if (ret == 0) {
+            break;
+        }
+        nread += static_cast<std::size_t>(ret);
+    }
+    return std::string_view(buf, nread);
+}
@@ -0,0 +1,65 @@
+#ifndef DaqService_Plugins_ProcFile_h
+#define DaqService_Plugins_ProcFile_h
+
+// Reader of small files under /proc without heap allocation.
+// The file descriptor is kept open and the whole file is read with pread() from offset 0
+// into a buffer of the caller. Fields are parsed in place.
+
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace daq::service {
+
+class ProcFile {
+public:
+    static constexpr std::size_t BufferSize{4096};
+
+    ProcFile() = default;
+    explicit ProcFile(const std::string &path);
+    ProcFile(const ProcFile&) = delete;
+    ProcFile& operator=(const ProcFile&) = delete;
+    ProcFile(ProcFile &&other) noexcept;
+    ProcFile& operator=(ProcFile &&other) noexcept;
+    ~ProcFile();
+
+    bool IsOpen() const {
+        return fFd >= 0;
+    }
+    bool Open(const std::string &path);
+    void Close();
+    // returns the content (truncated to n bytes). empty on error
+    std::string_view Read(char *buf, std::size_t n) const;
+
+private:
+    int fFd{-1};
+};
+
+//_____________________________________________________________________________
+// Returns the next field separated by white spaces and removes it from s.
+inline std::string_view NextField(std::string_view &s)
+{
+    const auto b = s.find_first_not_of(" \t\n");
+    if (b == std::string_view::npos) {
+        s = {};
+        return {};
+    }
+    const auto e = s.find_first_of(" \t\n", b);
+    const auto ret = s.substr(b, (e == std::string_view::npos) ? std::string_view::npos : e - b);
+    s.remove_prefix((e == std::string_view::npos) ? s.size() : e);
+    return ret;
+}
+
+//_____________________________________________________________________________
+inline uint64_t ToUInt64(std::string_view s)
+{
+    uint64_t ret{0};
+    std::from_chars(s.data(), s.data() + s.size(), ret);
+    return ret;
+}
+
+} // namespace daq::service
+
+#endif
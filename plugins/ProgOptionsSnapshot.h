@@ -0,0 +1,102 @@
+#ifndef DaqService_Plugins_ProgOptionsSnapshot_h
+#define DaqService_Plugins_ProgOptionsSnapshot_h
+
+// Program options of the device as written in the redis hash <top>:<service>:<id>:prog-options.
+// Each field is serialized once when it is added and again only when the property changes
+// (Update() is called from the property change callback), so that only the changed fields are sent.
+//
+//   snapshot.Add("severity", [this]() { return GetProperty<std::string>("severity"); });
+//   ...
+//   auto changes = snapshot.TakeChanges(); // all fields at the first call
+//   client.hset(key, changes.cbegin(), changes.cend());
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace daq::service {
+
+class ProgOptionsSnapshot {
+public:
+    // returns the value of the field as the string written in the hash
+    using Reader = std::function<std::string()>;
+    using Changes = std::vector<std::pair<std::string, std::string>>;
+
+    // field name = property key
+    void Add(const std::string &field, Reader reader) {
+        auto value = reader();
+        std::lock_guard<std::mutex> lock{fMutex};
+        fFields[field] = {std::move(reader), std::move(value), true};
+    }
+    bool Empty() {
+        std::lock_guard<std::mutex> lock{fMutex};
+        return fFields.empty();
+    }
+    // re-read the field if the property is one of the fields. returns true if the value has changed
+    bool Update(const std::string &key) {
+        Reader reader;
+        {
+            std::lock_guard<std::mutex> lock{fMutex};
+            auto itr = fFields.find(key);
+            if (itr == fFields.end()) {
+                return false;
+            }
+            reader = itr->second.reader;
+        }
+        auto value = reader();
+        std::lock_guard<std::mutex> lock{fMutex};
+        auto &f = fFields[key];
+        if (f.value == value) {
+            return false;
+        }
+        f.value = std::move(value);
+        f.dirty = true;
+        return true;
+    }
+    // fields changed since the last call
+    Changes TakeChanges() {
+        Changes ret;
+        std::lock_guard<std::mutex> lock{fMutex};
+        for (auto &[name, f] : fFields) {
+            if (f.dirty) {
+                ret.emplace_back(name, f.value);
+                f.dirty = false;
+            }
+        }
+        return ret;
+    }
+    // send the fields again (e.g. the write of the changes failed)
+    void MarkDirty(const Changes &changes) {
+        std::lock_guard<std::mutex> lock{fMutex};
+        for (const auto &c : changes) {
+            auto itr = fFields.find(c.first);
+            if (itr != fFields.end()) {
+                itr->second.dirty = true;
+            }
+        }
+    }
+    // send all fields at the next call of TakeChanges() (e.g. the hash has been lost)
+    void MarkAllDirty() {
+        std::lock_guard<std::mutex> lock{fMutex};
+        for (auto &[name, f] : fFields) {
+            f.dirty = true;
+        }
+    }
+
+private:
+    struct Field {
+        Reader reader;
+        std::string value;
+        bool dirty{false};
+    };
+
+    std::mutex fMutex;
+    std::map<std::string, Field> fFields;
+};
+
+} // namespace daq::service
+
+#endif
@@ -0,0 +1,189 @@
+#include <cctype>
+#include <istream>
+
+#include <fairmq/FairMQLogger.h>
+
+#include "plugins/PrometheusExporter.h"
+
+namespace {
+static constexpr std::string_view MyClass{"daq::service::PrometheusExporter"};
+static constexpr std::string_view NamePrefix{"nestdaq_"};
+
+//_____________________________________________________________________________
+// [a-zA-Z_:][a-zA-Z0-9_:]*
+std::string ToMetricName(std::string_view s)
+{
+    std::string ret{NamePrefix};
+    for (auto c : s) {
+        ret += std::isalnum(static_cast<unsigned char>(c)) ? c : '_';
+    }
+    return ret;
+}
+
+//_____________________________________________________________________________
+std::string EscapeLabelValue(std::string_view s)
+{
+    std::string ret;
+    for (auto c : s) {
+        switch (c) {
+        case '\\':
+            ret += "\\\\";
+            break;
+        case '"':
+            ret += "\\\"";
+            break;
+        case '\n':
+            ret += "\\n";
+            break;
+        default:
+            ret += c;
+            break;
+        }
+    }
+    return ret;
+}
+} // namespace
+
+//_____________________________________________________________________________
+daq::service::PrometheusExporter::PrometheusExporter(const std::shared_ptr<net::io_context> &ctx,
+        const std::string &address,
+        unsigned short port)
+    : fContext(ctx),
+      fAcceptor(*ctx, address.empty() ? net::ip::tcp::endpoint(net::ip::tcp::v4(), port)
+                                      : net::ip::tcp::endpoint(net::ip::make_address(address), port))
+{
+    LOG(info) << MyClass << " listening on " << fAcceptor.local_endpoint().address().to_string() << ":" << Port();
+    Accept();
+}
+
+//_____________________________________________________________________________
+daq::service::PrometheusExporter::~PrometheusExporter()
+{
+    boost::system::error_code ec;
+    fAcceptor.close(ec);
+}
+
+//_____________________________________________________________________________
+void daq::service::PrometheusExporter::Accept()
+{
+    auto socket = std::make_shared<net::ip::tcp::socket>(*fContext);
+    fAcceptor.async_accept(*socket, [this, socket](const boost::system::error_code &ec) {
+        if (ec) {
+            if (ec != net::error::operation_aborted) {
+                LOG(error) << MyClass << " accept failed: " << ec.message();
+                Accept();
+            }
+            return;
+        }
+        Serve(socket);
+        Accept();
+    });
+}
+
+//_____________________________________________________________________________
+void daq::service::PrometheusExporter::Add(const std::string &key, const MetricLabels &labels, int64_t timestamp, const std::string &value)
+{
+    auto itr = labels.find("data");
+    const auto name = ToMetricName((itr != labels.end()) ? std::string_view(itr->second) : std::string_view(key));
+    auto &line = fPending[name + " " + key];
+    line.name = name;
+    line.text = name + "{ts_key=\"" + EscapeLabelValue(key) + "\"";
+    for (const auto &[k, v] : labels) {
+        if (k == "data") {
+            continue;
+        }
+        line.text += "," + ToMetricName(k).substr(NamePrefix.size()) + "=\"" + EscapeLabelValue(v) + "\"";
+    }
+    line.text += "} " + value + " " + std::to_string(timestamp) + "\n";
+}
+
+//_____________________________________________________________________________
+void daq::service::PrometheusExporter::Flush()
+{
+    if (fPending.empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock{fMutex};
+    for (auto &[k, line] : fPending) {
+        fLines[k] = std::move(line);
+    }
+    fPending.clear();
+}
+
+//_____________________________________________________________________________
+unsigned short daq::service::PrometheusExporter::Port() const
+{
+    return fAcceptor.local_endpoint().port();
+}
+
+//_____________________________________________________________________________
+void daq::service::PrometheusExporter::Remove(const std::string &key)
+{
+    const auto suffix = " " + key;
+    auto erase = [&suffix](std::map<std::string, Line> &lines) {
+        for (auto itr = lines.begin(); itr != lines.end();) {
+            const auto &k = itr->first;
+            if ((k.size() > suffix.size()) && (k.compare(k.size() - suffix.size(), suffix.size(), suffix) == 0)) {
+                itr = lines.erase(itr);
+            } else {
+                ++itr;
+            }
+        }
+    };
+    erase(fPending);
+    std::lock_guard<std::mutex> lock{fMutex};
+    erase(fLines);
+}
+
+//_____________________________________________________________________________
+void daq::service::PrometheusExporter::Serve(const std::shared_ptr<net::ip::tcp::socket> &socket)
+{
+    // a request larger than MaxRequestSize fails with not_found and the connection is closed
+    auto request = std::make_shared<net::streambuf>(MaxRequestSize);
+    net::async_read_until(*socket, *request, "\r\n\r\n",
+    [this, socket, request](const boost::system::error_code &ec, std::size_t) {
+        if (ec) {
+            if (ec == net::error::not_found) {
+                LOG(warn) << MyClass << " request header too large (> " << MaxRequestSize << " bytes). connection closed";
+            }
+            boost::system::error_code ignored;
+            socket->close(ignored);
+            return;
+        }
+        std::istream is(request.get());
+        std::string method, target;
+        is >> method >> target;
+
+        auto response = std::make_shared<std::string>();
+        if ((method == "GET") && ((target == "/metrics") || (target == "/"))) {
+            const auto body = Text();
+            *response = "HTTP/1.1 200 OK\r\n"
+                        "Content-Type: text/plain; version=0.0.4\r\n"
+                        "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                        "Connection: close\r\n\r\n" + body;
+        } else {
+            *response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        }
+        net::async_write(*socket, net::buffer(*response),
+        [socket, response](const boost::system::error_code &, std::size_t) {
+            boost::system::error_code ignored;
+            socket->shutdown(net::ip::tcp::socket::shutdown_both, ignored);
+        });
+    });
+}
+
+//_____________________________________________________________________________
+std::string daq::service::PrometheusExporter::Text() const
+{
+    std::string ret;
+    std::string name;
+    std::lock_guard<std::mutex> lock{fMutex};
+    for (const auto &[k, line] : fLines) {
+        if (line.name != name) {
+            name = line.name;
+            ret += "# TYPE " + name + " gauge\n";
+        }
+        ret += line.text;
+    }
+    return ret;
+}
@@ -0,0 +1,59 @@
+#ifndef DaqService_Plugins_PrometheusExporter_h
+#define DaqService_Plugins_PrometheusExporter_h
+
+// Prometheus text exposition of the metrics on http://<address>:<port>/metrics.
+// The HTTP endpoint runs on the io_context of the metrics plugin.
+// A scrape returns the latest sample of each time series as of the last flush.
+// With port 0, a free port is chosen by the kernel (see Port()).
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <boost/asio.hpp>
+
+#include "plugins/MetricsExporter.h"
+#include "plugins/Timer.h"
+
+namespace daq::service {
+
+class PrometheusExporter : public MetricsExporter {
+public:
+    // upper limit of the size of an HTTP request header
+    static constexpr std::size_t MaxRequestSize{8192};
+
+    // address : IP address to listen on (empty = all interfaces)
+    PrometheusExporter(const std::shared_ptr<net::io_context> &ctx, const std::string &address, unsigned short port);
+    PrometheusExporter(const PrometheusExporter&) = delete;
+    PrometheusExporter& operator=(const PrometheusExporter&) = delete;
+    ~PrometheusExporter() override;
+
+    void Add(const std::string &key, const MetricLabels &labels, int64_t timestamp, const std::string &value) override;
+    void Flush() override;
+    // bound TCP port
+    unsigned short Port() const;
+    void Remove(const std::string &key) override;
+
+private:
+    struct Line {
+        std::string name;
+        std::string text;
+    };
+
+    void Accept();
+    void Serve(const std::shared_ptr<net::ip::tcp::socket> &socket);
+    std::string Text() const;
+
+    std::shared_ptr<net::io_context> fContext;
+    net::ip::tcp::acceptor fAcceptor;
+    // key = <metric name> <ts key> (lines of the same metric are adjacent)
+    std::map<std::string, Line> fPending;
+    mutable std::mutex fMutex;
+    std::map<std::string, Line> fLines;
+};
+
+} // namespace daq::service
+
+#endif
@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <chrono>
+#include <optional>
+#include <unordered_set>
+
+#include <fairmq/FairMQLogger.h>
+
+#include <sw/redis++/redis++.h>
+#include <sw/redis++/errors.h>
+
+#include "plugins/RedisConnections.h"
+
+static constexpr std::string_view MyClass{"daq::service::RedisConnections"};
+
+namespace {
+constexpr std::chrono::milliseconds SubscriberTimeout{100};
+constexpr std::chrono::milliseconds ReconnectInterval{1000};
+} // namespace
+
+//_____________________________________________________________________________
+daq::service::RedisConnections::RedisConnections(const std::string &uri, std::size_t poolSize)
+    : fUri(uri)
+{
+    sw::redis::ConnectionOptions opts(uri);
+    sw::redis::ConnectionPoolOptions poolOpts;
+    poolOpts.size = std::max<std::size_t>(1, poolSize);
+    fClient = std::make_shared<sw::redis::Redis>(opts, poolOpts);
+
+    opts.socket_timeout = SubscriberTimeout;
+    fSubscriberClient = std::make_unique<sw::redis::Redis>(opts);
+    LOG(debug) << MyClass << " uri = " << uri << ", pool size = " << poolOpts.size;
+}
+
+//_____________________________________________________________________________
+daq::service::RedisConnections::~RedisConnections()
+{
+    fStopRequested = true;
+    if (fSubscriberThread.joinable()) {
+        fSubscriberThread.join();
+    }
+}
+
+//_____________________________________________________________________________
+void daq::service::RedisConnections::Consume()
+{
+    // (un)subscribe and consume are done only in this thread (sw::redis::Subscriber is not thread safe)
+    auto connect = [this]() {
+        auto sub = fSubscriberClient->subscriber();
+        sub.on_message([this](std::string channel, std::string msg) {
+            std::lock_guard<std::mutex> lock{fMutex};
+            for (const auto &s : fSubscriptions) {
+                if (s.channel != channel) {
+                    continue;
+                }
+                try {
+                    s.callback(channel, msg);
+                } catch (const std::exception &e) {
+                    LOG(error) << MyClass << " exception in callback (channel = " << channel << ") : " << e.what();
+                }
+            }
+        });
+        return sub;
+    };
+
+    // (re)connected in the loop, so that an unreachable server at the start is retried like a lost connection
+    std::optional<sw::redis::Subscriber> sub;
+    std::unordered_set<std::string> subscribed;
+    while (!fStopRequested) {
+        try {
+            if (!sub) {
+                sub.emplace(connect());
+                subscribed.clear();
+            }
+            std::unordered_set<std::string> wanted;
+            {
+                std::lock_guard<std::mutex> lock{fMutex};
+                for (const auto &s : fSubscriptions) {
+                    wanted.insert(s.channel);
+                }
+            }
+            for (const auto &ch : wanted) {
+                if (subscribed.insert(ch).second) {
+                    sub->subscribe(ch);
+                }
+            }
+            for (auto itr = subscribed.begin(); itr != subscribed.end();) {
+                if (wanted.count(*itr) == 0) {
+                    sub->unsubscribe(*itr);
+                    itr = subscribed.erase(itr);
+                } else {
+                    ++itr;
+                }
+            }
+            sub->consume();
+        } catch (const sw::redis::TimeoutError &) {
+            // no message. check the requests and try again.
+        } catch (const sw::redis::Error &e) {
+            LOG(error) << MyClass << " " << __func__ << " : " << (sub ? "error in consume(): " : "connect failed: ") << e.what() << ". reconnect";
+            sub.reset();
+            std::this_thread::sleep_for(ReconnectInterval);
+        }
+    }
+    LOG(debug) << MyClass << " " << __func__ << " exit.";
+}
+
+//_____________________________________________________________________________
+uint64_t daq::service::RedisConnections::Subscribe(const std::string &channel, MessageCallback f)
+{
+    std::lock_guard<std::mutex> lock{fMutex};
+    const auto id = fNextId++;
+    fSubscriptions.push_back({id, channel, std::move(f)});
+    if (!fSubscriberThread.joinable()) {
+        fSubscriberThread = std::thread([this]() {
+            Consume();
+        });
+    }
+    return id;
+}
+
+//_____________________________________________________________________________
+void daq::service::RedisConnections::Unsubscribe(uint64_t id)
+{
+    std::lock_guard<std::mutex> lock{fMutex};
+    fSubscriptions.erase(std::remove_if(fSubscriptions.begin(), fSubscriptions.end(), [id](const auto &s) {
+        return s.id == id;
+    }), fSubscriptions.end());
+}
@@ -0,0 +1,117 @@
+#ifndef DaqService_Plugins_RedisConnections_h
+#define DaqService_Plugins_RedisConnections_h
+
+// Redis connections shared by the plugins of one device process (daq_service, metrics, parameter_config).
+// Commands go through one sw::redis::Redis with a connection pool (thread safe. short-lived pipelines
+// should be created with pipeline(false) to borrow a pooled connection instead of opening a new one).
+// Pub/Sub messages of all plugins are received by one subscriber connection and dispatched to the
+// callbacks by channel.
+//
+// The first plugin which calls GetRedisConnections() registers "GetRedisConnections()" as a property,
+// and the other plugins get the same instance for the same URI from the property
+// (in the same way as "GetPeerStateOfBindChannels()" of the daq_service plugin).
+//
+//   fConnections = daq::service::GetRedisConnections(*this, uri);
+//   fClient      = fConnections->GetClient();
+//   auto id      = fConnections->Subscribe(channel, [](const auto &channel, const auto &msg) { ... });
+//   ...
+//   fConnections->Unsubscribe(id);
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "plugins/Constants.h"
+
+// forward declaration
+namespace sw::redis {
+class Redis;
+}
+
+namespace daq::service {
+
+static constexpr std::string_view GetRedisConnectionsFunction{"GetRedisConnections()"};
+
+class RedisConnections {
+public:
+    static constexpr std::size_t DefaultPoolSize{3};
+
+    // called in the subscriber thread with the lock of the subscriptions:
+    // must not block and must not call Subscribe() / Unsubscribe(). hand over the work to the thread of the plugin.
+    using MessageCallback = std::function<void(const std::string &channel, const std::string &msg)>;
+
+    RedisConnections(const std::string &uri, std::size_t poolSize);
+    RedisConnections(const RedisConnections&) = delete;
+    RedisConnections& operator=(const RedisConnections&) = delete;
+    ~RedisConnections();
+
+    std::shared_ptr<sw::redis::Redis> GetClient() const {
+        return fClient;
+    }
+    const std::string& GetUri() const {
+        return fUri;
+    }
+    // returns the id for Unsubscribe(). the subscriber thread is started by the first call
+    uint64_t Subscribe(const std::string &channel, MessageCallback f);
+    // the callback is not called after return
+    void Unsubscribe(uint64_t id);
+
+private:
+    struct Subscription {
+        uint64_t id;
+        std::string channel;
+        MessageCallback callback;
+    };
+
+    void Consume();
+
+    std::string fUri;
+    std::shared_ptr<sw::redis::Redis> fClient;
+    // with a socket timeout, so that the subscriber thread checks the (un)subscribe requests periodically
+    std::unique_ptr<sw::redis::Redis> fSubscriberClient;
+
+    std::mutex fMutex;
+    uint64_t fNextId{1};
+    std::vector<Subscription> fSubscriptions;
+    std::atomic<bool> fStopRequested{false};
+    std::thread fSubscriberThread;
+};
+
+// key = URI
+using RedisConnectionsFunction_t = std::function<std::shared_ptr<RedisConnections>(const std::string &uri)>;
+
+//_____________________________________________________________________________
+// Returns the connections of the process for the URI (created if there is none).
+template <typename Plugin>
+inline std::shared_ptr<RedisConnections> GetRedisConnections(Plugin &plugin, const std::string &uri)
+{
+    if (!plugin.PropertyExists(GetRedisConnectionsFunction.data())) {
+        const auto poolSize = plugin.PropertyExists(RedisPoolSize.data())
+                              ? plugin.template GetProperty<std::size_t>(RedisPoolSize.data())
+                              : RedisConnections::DefaultPoolSize;
+        // weak_ptr: the connections are closed when the last plugin releases them
+        auto registry = std::make_shared<std::pair<std::mutex, std::map<std::string, std::weak_ptr<RedisConnections>>>>();
+        plugin.template SetProperty<RedisConnectionsFunction_t>(GetRedisConnectionsFunction.data(), [registry, poolSize](const std::string &key) {
+            std::lock_guard<std::mutex> lock{registry->first};
+            auto &w  = registry->second[key];
+            auto ret = w.lock();
+            if (!ret) {
+                ret = std::make_shared<RedisConnections>(key, poolSize);
+                w   = ret;
+            }
+            return ret;
+        });
+    }
+    return plugin.template GetProperty<RedisConnectionsFunction_t>(GetRedisConnectionsFunction.data())(uri);
+}
+
+} // namespace daq::service
+
+#endif
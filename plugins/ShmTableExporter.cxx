@@ -0,0 +1,85 @@
+#include <cstdlib>
+#include <stdexcept>
+
+#include <fairmq/FairMQLogger.h>
+
+#include "plugins/ShmTableExporter.h"
+
+namespace {
+static constexpr std::string_view MyClass{"daq::service::ShmTableExporter"};
+
+//_____________________________________________________________________________
+std::string ToString(const daq::service::MetricLabels &labels)
+{
+    std::string ret;
+    for (const auto &[k, v] : labels) {
+        ret += k + "=" + v + "\n";
+    }
+    return ret;
+}
+}
+
+//_____________________________________________________________________________
+daq::service::ShmTableExporter::ShmTableExporter(const std::string &id, uint32_t capacity)
+    : fTable(MetricsShmTable::Create(id, capacity))
+{
+    if (!fTable) {
+        throw std::runtime_error("failed to create shared memory table " + MetricsShmTable::Name(id));
+    }
+    LOG(info) << MyClass << " " << fTable->GetName() << " capacity = " << capacity;
+}
+
+//_____________________________________________________________________________
+void daq::service::ShmTableExporter::Add(const std::string &key, const MetricLabels &labels, int64_t timestamp, const std::string &value)
+{
+    auto itr = fIndex.find(key);
+    const auto isNew = (itr == fIndex.end());
+    if (isNew) {
+        itr = fIndex.emplace(key, Slot{-1, labels, false}).first;
+    } else if (itr->second.labels != labels) {
+        auto &slot = itr->second;
+        slot.labels = labels;
+        if (slot.index >= 0) {
+            const auto l = ToString(labels);
+            if (!fTable->SetLabels(slot.index, l)) {
+                LOG(warn) << MyClass << " labels too long (" << l.size() << " >= " << MetricsShmTable::LabelsSize << " bytes). series dropped: " << key;
+                fTable->Remove(slot.index);
+                slot.index   = -1;
+                slot.tooLong = true;
+            }
+        } else {
+            slot.tooLong = false;
+        }
+    }
+    auto &slot = itr->second;
+    if ((slot.index < 0) && !slot.tooLong && (isNew || fTable->HasRoom())) {
+        // new series, or series dropped while the table was full and added when an entry has been freed
+        const auto l = ToString(labels);
+        slot.index   = fTable->Add(key, l);
+        slot.tooLong = (key.size() >= MetricsShmTable::KeySize) || (l.size() >= MetricsShmTable::LabelsSize);
+        // logged once per series. the samples of the series are not exported.
+        if (isNew && (key.size() >= MetricsShmTable::KeySize)) {
+            LOG(warn) << MyClass << " key too long (" << key.size() << " >= " << MetricsShmTable::KeySize << " bytes). series dropped: " << key;
+        } else if (isNew && (l.size() >= MetricsShmTable::LabelsSize)) {
+            LOG(warn) << MyClass << " labels too long (" << l.size() << " >= " << MetricsShmTable::LabelsSize << " bytes). series dropped: " << key;
+        } else if (isNew && (slot.index < 0)) {
+            LOG(warn) << MyClass << " table full (capacity = " << fTable->Capacity() << "). series dropped: " << key;
+        }
+    }
+    if (itr->second.index >= 0) {
+        fTable->Update(itr->second.index, std::strtod(value.data(), nullptr), timestamp);
+    }
+}
+
+//_____________________________________________________________________________
+void daq::service::ShmTableExporter::Remove(const std::string &key)
+{
+    auto itr = fIndex.find(key);
+    if (itr == fIndex.end()) {
+        return;
+    }
+    if (itr->second.index >= 0) {
+        fTable->Remove(itr->second.index);
+    }
+    fIndex.erase(itr);
+}
@@ -0,0 +1,43 @@
+#ifndef DaqService_Plugins_ShmTableExporter_h
+#define DaqService_Plugins_ShmTableExporter_h
+
+// Writes the latest sample of each time series into the shared memory table of the device,
+// which is read and sent to Redis by the per-host aggregator (daq-metrics-aggregator).
+// The entries of removed series are reused, and the labels are rewritten when they change.
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "plugins/MetricsExporter.h"
+#include "plugins/MetricsShmTable.h"
+
+namespace daq::service {
+
+class ShmTableExporter : public MetricsExporter {
+public:
+    ShmTableExporter(const std::string &id, uint32_t capacity);
+    ShmTableExporter(const ShmTableExporter&) = delete;
+    ShmTableExporter& operator=(const ShmTableExporter&) = delete;
+    ~ShmTableExporter() override = default;
+
+    void Add(const std::string &key, const MetricLabels &labels, int64_t timestamp, const std::string &value) override;
+    void Flush() override {}
+    // the entry is freed and reused by the next series
+    void Remove(const std::string &key) override;
+
+private:
+    struct Slot {
+        int index{-1}; // index of the table entry (-1 if the table is full or the key or labels are too long)
+        MetricLabels labels; // rewritten in the table when they change (e.g. run number)
+        bool tooLong{false}; // the key or labels do not fit (not added again until the labels change)
+    };
+
+    std::unique_ptr<MetricsShmTable> fTable;
+    // key = ts key
+    std::unordered_map<std::string, Slot> fIndex;
+};
+
+} // namespace daq::service
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef DaqService_Plugins_SocketCounters_h
+#define DaqService_Plugins_SocketCounters_h
+
+// Message and byte counters of the device's channel sockets.
+// A device exposes them to the metrics plugin as a function property,
+// in the same way as "GetPeerStateOfBindChannels()" of the daq_service plugin.
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+
+namespace daq::service {
+
+static constexpr std::string_view GetSocketCountersFunction{"GetSocketCounters()"};
+
+struct SocketCounters {
+    uint64_t msgIn{0};
+    uint64_t msgOut{0};
+    uint64_t bytesIn{0};
+    uint64_t bytesOut{0};
+};
+
+// key = <channel-name>[<sub-channel-index>]
+using SocketCountersMap = std::map<std::string, SocketCounters>;
+using SocketCountersFunction_t = std::function<SocketCountersMap()>;
+
+//_____________________________________________________________________________
+// Register "GetSocketCounters()" as a property of the device.
+// Call this from the device (e.g. in InitTask()) to enable the sampling mode of the metrics plugin.
+template <typename Device>
+inline void RegisterSocketCounters(Device &device)
+{
+    device.GetConfig()->template SetProperty<SocketCountersFunction_t>(GetSocketCountersFunction.data(), [&device]() {
+        SocketCountersMap ret;
+        for (const auto &[name, subChannels] : device.fChannels) {
+            for (auto i = 0u; i < subChannels.size(); ++i) {
+                const auto &ch = subChannels[i];
+                auto &c = ret[name + "[" + std::to_string(i) + "]"];
+                c.msgIn    = ch.GetMessagesRx();
+                c.msgOut   = ch.GetMessagesTx();
+                c.bytesIn  = ch.GetBytesRx();
+                c.bytesOut = ch.GetBytesTx();
+            }
+        }
+        return ret;
+    });
+}
+
+} // namespace daq::service
+
+#endif
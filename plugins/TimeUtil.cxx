@@ -16,6 +16,12 @@ const std::string daq::service::to_date(const std::chrono::system_clock::time_po
     return ret.str();
 }
 
+//_____________________________________________________________________________
+int64_t daq::service::to_msec(const std::chrono::system_clock::time_point &p)
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(p.time_since_epoch()).count();
+}
+
 //_____________________________________________________________________________
 auto daq::service::update_date(const std::chrono::system_clock::time_point &s,
                                const std::chrono::steady_clock::time_point &t)
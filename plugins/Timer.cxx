@@ -44,4 +44,54 @@ void daq::service::Timer::Start()
             // std::cout << " no restart timer" << std::endl;
         }
     });
-}
\ No newline at end of file
+}
+
+//______________________________________________________________________________
+daq::service::PeriodicTimer::~PeriodicTimer()
+{
+    Stop();
+}
+
+//______________________________________________________________________________
+void daq::service::PeriodicTimer::Start(const std::shared_ptr<net::io_context> &ctx,
+                                        unsigned int periodMS,
+                                        std::function<void()> f)
+{
+    fContext  = ctx;
+    fTimer    = std::make_unique<net::steady_timer>(*fContext);
+    fPeriod   = std::chrono::milliseconds(periodMS);
+    fHandle   = f;
+    fDeadline = std::chrono::steady_clock::now();
+    Wait();
+}
+
+//______________________________________________________________________________
+void daq::service::PeriodicTimer::Stop()
+{
+    if (fTimer) {
+        fTimer->cancel();
+    }
+}
+
+//_____________________________________________________________________________
+void daq::service::PeriodicTimer::Wait()
+{
+    const auto now = std::chrono::steady_clock::now();
+    fDeadline += fPeriod;
+    if (fDeadline <= now) {
+        // skip the missed ticks but keep the phase
+        fDeadline += ((now - fDeadline) / fPeriod + 1) * fPeriod;
+    }
+    fTimer->expires_at(fDeadline);
+    fTimer->async_wait( //
+    [this](const auto &ec) {
+        if (ec == std::errc::operation_canceled) {
+            return;
+        } else if (ec) {
+            std::cout << " error. periodic timer stopped: " << ec.message() << std::endl;
+            return;
+        }
+        fHandle();
+        Wait();
+    });
+}
@@ -1,6 +1,7 @@
 #ifndef DaqService_Timer_h
 #define DaqService_Timer_h
 
+#include <chrono>
 #include <functional>
 #include <memory>
 #include <boost/asio.hpp>
@@ -30,6 +31,31 @@ private:
 
 };
 
+// Timer for periodic sampling.
+// The deadlines are fixed at start + n * period, so that the execution time of the handler
+// does not accumulate (no drift). When the handler overruns, the missed ticks are skipped.
+class PeriodicTimer {
+public:
+    PeriodicTimer() = default;
+    PeriodicTimer(const PeriodicTimer&) = delete;
+    PeriodicTimer& operator=(const PeriodicTimer&) = delete;
+    ~PeriodicTimer();
+
+    void Start(const std::shared_ptr<net::io_context> &ctx,
+               unsigned int periodMS,
+               std::function<void()> f);
+    void Stop();
+
+private:
+    void Wait();
+
+    std::shared_ptr<net::io_context> fContext;
+    std::unique_ptr<net::steady_timer> fTimer;
+    std::chrono::steady_clock::duration fPeriod{0};
+    std::chrono::steady_clock::time_point fDeadline;
+    std::function<void()> fHandle;
+};
+
 } // namespace daq::service
 
 #endif
@@ -971,13 +971,10 @@ void daq::service::TopologyConfig::Reset()
 }
 
 //_____________________________________________________________________________
-void daq::service::TopologyConfig::ResetTtl(sw::redis::Pipeline& pipe)
+void daq::service::TopologyConfig::AppendRegisteredKeys(std::vector<std::string>& keys) const
 {
     //LOG(debug) << MyClass << " " << __FUNCTION__ << " num registered = " << fRegisteredKeys.size();
-    std::for_each(fRegisteredKeys.cbegin(), fRegisteredKeys.cend(),
-    [&pipe, ttl = fMaxTtl](const auto& key) {
-        pipe.expire(key, ttl);
-    });
+    keys.insert(keys.end(), fRegisteredKeys.cbegin(), fRegisteredKeys.cend());
 }
 
 //_____________________________________________________________________________
@@ -1262,7 +1259,7 @@ void daq::service::TopologyConfig::WaitForPeerConnection()
 void daq::service::TopologyConfig::WriteAddress(MQChannel &channels, std::function<void (sw::redis::Pipeline&, std::string_view)> f)
 {
     auto &r    = *GetClient();
-    auto pipe  = r.pipeline();
+    auto pipe  = r.pipeline(false);
 
     std::lock_guard<std::mutex> lock{GetMutex()};
     try {
@@ -1335,7 +1332,7 @@ void daq::service::TopologyConfig::WriteChannel(SocketProperty &sp, const std::v
     LOG(debug) << MyClass << " " << __FUNCTION__ << " channel : " << sp.name << " : n peers = " << peers.size();
     fPlugin.SetProperty("n-peers:"s+sp.name, std::to_string(peers.size()));
 
-    auto pipe = GetClient()->pipeline();
+    auto pipe = GetClient()->pipeline(false);
     pipe.hset(key, {
         std::make_pair("name",                  sp.name),
         std::make_pair("type",                  sp.type),
@@ -47,7 +47,8 @@ public:
 
     void OnDeviceStateChange(DeviceState newState);
     void Reset();
-    void ResetTtl(sw::redis::Pipeline& pipe);
+    // keys refreshed by the heartbeat of the plugin
+    void AppendRegisteredKeys(std::vector<std::string>& keys) const;
     void SetConnectConfig(std::string_view arg) {
         fConnectConfig = arg.data();
     }